@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,52 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts channel CHANNEL counting down CYCLES PIT cycles, once,
+   in mode 0: its output goes from 0 to 1 when the count runs
+   out, raising one interrupt on channel 0, and stays there until
+   the channel is configured again.  CYCLES must be between 1 and
+   65535.  Used by devices/timer.c to stop the periodic timer
+   interrupt while the CPU is idle. */
+void
+pit_start_oneshot (int channel, unsigned cycles)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+  ASSERT (cycles >= 1 && cycles <= 0xffff);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), cycles);
+  outb (PIT_PORT_COUNTER (channel), cycles >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current count of CHANNEL, that is, the number of
+   PIT cycles left before it next reaches the end of its count.
+   Also stores the state of the channel's output in *OUTPUT,
+   which for a one-shot started with pit_start_oneshot() tells
+   whether it has run out.  In that case the count keeps going
+   down from 0, wrapping around to 65535.
+
+   Uses the 8254 read-back command, which latches the output and
+   the count at the same instant. */
+unsigned
+pit_read_counter (int channel, bool *output)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  *output = (status & 0x80) != 0;
+  return lo | (hi << 8);
+}
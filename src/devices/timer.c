@@ -1,10 +1,12 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <random.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -24,17 +26,104 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Timing wheel, which holds the pending timeouts.
+
+   There are WHEEL_LEVELS levels of WHEEL_SLOTS slots each, and a
+   timeout is kept in one slot of one level.  Level 0 has a slot
+   for each of the next WHEEL_SLOTS ticks, and a slot of level N
+   covers WHEEL_SLOTS times as many ticks as a slot of level N - 1,
+   so the wheel spans WHEEL_SPAN ticks; a timeout due later than
+   that waits in the slot for the last tick it spans.  Adding or
+   cancelling a timeout is one list insertion or removal.
+
+   At each tick the level 0 slot for that tick expires.  Whenever
+   level N - 1 wraps around, the next slot of level N "cascades":
+   its timeouts, now due within the span of the lower levels, are
+   added again, which puts each of them in a lower level.
+
+   The timer interrupt leaves this work to wheel_run(), as
+   deferred work.  Expired timeouts move to expired_list, and the
+   "timeout" thread calls their functions. */
+#define WHEEL_BITS 6                            /* Bits per level. */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)           /* Slots per level. */
+#define WHEEL_LEVELS 4                          /* Levels. */
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct list wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static int64_t wheel_tick;      /* Last tick the wheel handled, which
+                                   may be behind `ticks' for a moment. */
+static size_t wheel_cnt;        /* # of timeouts in the wheel. */
+static struct intr_work wheel_work;     /* Runs wheel_run(). */
+
+/* Timeouts whose functions are due to be called, and the
+   semaphore the timeout thread waits on for them. */
+static struct list expired_list;
+static struct semaphore expired_sema;
+
+static long long timeout_add_cnt;       /* # of timeouts added. */
+static long long timeout_cancel_cnt;    /* # of them cancelled. */
+static long long timeout_call_cnt;      /* # of them called. */
+
+/* Tickless idle.
+
+   If true, the periodic timer interrupt is stopped while the idle
+   thread runs: timer_idle_enter() starts the PIT counting down,
+   once, to the tick at which the first sleeping thread wakes,
+   and the ticks that pass without an interrupt are added to
+   `ticks' when the one-shot runs out or, if another interrupt
+   wakes the CPU first, when the idle thread is switched away
+   from.  Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick, as programmed by timer_init(). */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest one-shot the 16-bit PIT counter allows, in cycles. */
+#define ONESHOT_MAX 0xffff
+
+static bool oneshot;            /* Is a one-shot counting down? */
+static unsigned oneshot_cycles; /* Its length, in PIT cycles. */
+static unsigned oneshot_offset; /* Cycles past a tick when started. */
+static bool oneshot_stale;      /* Is its interrupt already counted? */
+
+/* Cycles by which timer interrupts come after the tick they
+   count.  The periodic timer restarts when a one-shot ends, so
+   it is usually not in step with whole ticks. */
+static unsigned phase;
+
+static long long oneshot_cnt;   /* # of one-shots started. */
+static long long skipped_cnt;   /* # of ticks they covered. */
+
 static intr_handler_func timer_interrupt;
+static void oneshot_end (unsigned left, bool expired);
+static void wheel_insert (struct timeout *);
+static void wheel_count_tick (void);
+static intr_work_func wheel_run;
+static int64_t wheel_next (int64_t limit);
+static void timeout_thread (void *aux);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
-   and registers the corresponding interrupt. */
+   and registers the corresponding interrupt.  Also starts the
+   thread that calls the functions of expired timeouts, which
+   first runs once the scheduler is started. */
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SLOTS; slot++)
+      list_init (&wheel[level][slot]);
+  list_init (&expired_list);
+  sema_init (&expired_sema, 0);
+  intr_work_init (&wheel_work, wheel_run, NULL);
+  if (thread_create ("timeout", PRI_MAX, timeout_thread, NULL) == TID_ERROR)
+    PANIC ("couldn't start timeout thread");
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -85,15 +174,16 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.  The thread is blocked, not left on the run
+   queue, until the timer interrupt wakes it. */
 void
 timer_sleep (int64_t ticks) 
 {
   int64_t start = timer_ticks ();
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks > 0)
+    thread_sleep (start + ticks);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -159,21 +249,429 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Initializes timeout T to call FUNCTION, passing AUX. */
+void
+timeout_init (struct timeout *t, timeout_func *function, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (function != NULL);
+
+  t->function = function;
+  t->aux = aux;
+  t->pending = false;
+  t->in_wheel = false;
+}
+
+/* Arranges for timeout T's function to be called TICKS timer
+   ticks from now, or at the next tick if TICKS is less than 1.
+   If T is already pending, it is moved to the new time.  May be
+   called from an interrupt handler. */
+void
+timeout_add (struct timeout *t, int64_t ticks_)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (t->pending)
+    {
+      list_remove (&t->elem);
+      if (t->in_wheel)
+        {
+          t->in_wheel = false;
+          wheel_cnt--;
+        }
+    }
+  t->expires = ticks + (ticks_ > 0 ? ticks_ : 1);
+  t->pending = true;
+  wheel_insert (t);
+  timeout_add_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Cancels timeout T.  Returns true if it was pending, false if
+   it was not, either because it was never added or because its
+   function has already been called or is being called.  May be
+   called from an interrupt handler. */
+bool
+timeout_cancel (struct timeout *t)
+{
+  enum intr_level old_level = intr_disable ();
+  bool pending = t->pending;
+
+  if (pending)
+    {
+      list_remove (&t->elem);
+      if (t->in_wheel)
+        {
+          t->in_wheel = false;
+          wheel_cnt--;
+        }
+      t->pending = false;
+      timeout_cancel_cnt++;
+    }
+  intr_set_level (old_level);
+  return pending;
+}
+
+/* Returns true if timeout T is waiting for its function to be
+   called. */
+bool
+timeout_pending (const struct timeout *t)
+{
+  return t->pending;
+}
+
+/* Timeout benchmark, for the "timer-bench" action. */
+#define BENCH_TIMEOUTS 1024             /* Timeouts pending at once. */
+#define BENCH_OPS (4 * 1000 * 1000)     /* Adds and cancels to time. */
+#define BENCH_CALLED 1000               /* Timeouts to let expire,
+                                           at most BENCH_TIMEOUTS. */
+
+/* A timeout that checks when it is called. */
+struct bench_timeout
+  {
+    struct timeout timeout;
+    bool cancelled;                     /* Cancelled before due? */
+  };
+
+/* State of the expiry half of the benchmark. */
+struct bench
+  {
+    struct semaphore done;              /* Up'd by the last one called. */
+    int left;                           /* # not yet called. */
+    int wrong;                          /* # called early or cancelled. */
+    int64_t latest;                     /* Most ticks late. */
+  };
+
+static struct bench bench;
+
+/* Records the call of timeout BT_. */
+static void
+bench_called (void *bt_)
+{
+  struct bench_timeout *bt = bt_;
+  int64_t late = timer_ticks () - bt->timeout.expires;
+
+  if (late < 0 || bt->cancelled)
+    bench.wrong++;
+  if (late > bench.latest)
+    bench.latest = late;
+  if (--bench.left == 0)
+    sema_up (&bench.done);
+}
+
+/* Times BENCH_OPS adds and cancels of timeouts due up to a few
+   hours away, with BENCH_TIMEOUTS of them pending at once, then
+   adds BENCH_CALLED timeouts due within 2 seconds, cancels half
+   of them, and checks that the rest are called on time. */
+void
+timer_bench (char **argv UNUSED)
+{
+  struct bench_timeout *bts;
+  enum intr_level old_level;
+  int64_t start, elapsed;
+  int i;
+
+  bts = malloc (BENCH_TIMEOUTS * sizeof *bts);
+  if (bts == NULL)
+    PANIC ("timer-bench: out of memory");
+  for (i = 0; i < BENCH_TIMEOUTS; i++)
+    {
+      timeout_init (&bts[i].timeout, bench_called, &bts[i]);
+      bts[i].cancelled = false;
+    }
+
+  printf ("timer-bench: %d adds and cancels, %d pending...\n",
+          BENCH_OPS, BENCH_TIMEOUTS);
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_OPS; i += 2)
+    {
+      struct timeout *t = &bts[random_ulong () % BENCH_TIMEOUTS].timeout;
+
+      timeout_cancel (t);
+      timeout_add (t, 1000 + random_ulong () % (1000 * 1000));
+    }
+  for (i = 0; i < BENCH_TIMEOUTS; i++)
+    timeout_cancel (&bts[i].timeout);
+  elapsed = timer_elapsed (start);
+  printf ("timer-bench: took %"PRId64" ticks", elapsed);
+  if (elapsed > 0)
+    printf (", %"PRId64" operations per second",
+            BENCH_OPS * TIMER_FREQ / elapsed);
+  printf ("\n");
+
+  /* With interrupts off, none is called before the others are
+     added and half of them cancelled. */
+  old_level = intr_disable ();
+  sema_init (&bench.done, 0);
+  bench.left = BENCH_CALLED / 2;
+  bench.wrong = 0;
+  bench.latest = 0;
+  for (i = 0; i < BENCH_CALLED; i++)
+    timeout_add (&bts[i].timeout, 1 + random_ulong () % (2 * TIMER_FREQ));
+  for (i = 0; i < BENCH_CALLED; i += 2)
+    {
+      bts[i].cancelled = true;
+      timeout_cancel (&bts[i].timeout);
+    }
+  intr_set_level (old_level);
+  sema_down (&bench.done);
+  printf ("timer-bench: %d called, %d wrongly, at most %"PRId64
+          " ticks late\n", BENCH_CALLED / 2, bench.wrong, bench.latest);
+  free (bts);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  In tickless mode, replaces the periodic timer
+   interrupt by a single one at the tick when the first sleeping
+   thread wakes or timeout expires, or as close to it as the PIT
+   can count. */
+void
+timer_idle_enter (void)
+{
+  unsigned left, offset;
+  int64_t wait;
+  bool output;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (!timer_tickless || oneshot || oneshot_stale)
+    return;
+
+  /* The last timer interrupt came PHASE cycles after its tick;
+     the periodic count tells how long ago that was. */
+  left = pit_read_counter (0, &output);
+  offset = phase + (TICK_CYCLES - left);
+
+  wait = thread_next_wake () - ticks;
+  if (wait > (ONESHOT_MAX + offset) / TICK_CYCLES)
+    wait = (ONESHOT_MAX + offset) / TICK_CYCLES;
+  wait = wheel_next (ticks + wait) - ticks;
+  if (wait < 2)
+    return;
+
+  oneshot_cycles = wait * TICK_CYCLES - offset;
+  oneshot_offset = offset;
+  oneshot = true;
+  oneshot_cnt++;
+  pit_start_oneshot (0, oneshot_cycles);
+}
+
+/* Called when the idle thread stops running, with interrupts
+   off.  Ends a one-shot still counting down, because another
+   interrupt woke the CPU first, and brings `ticks' up to date. */
+void
+timer_idle_exit (void)
+{
+  unsigned left;
+  bool expired;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (!oneshot)
+    return;
+
+  /* If the one-shot ran out just now, its interrupt is still
+     pending, but its ticks are counted here. */
+  left = pit_read_counter (0, &expired);
+  oneshot_end (left, expired);
+  oneshot_stale = expired;
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (timeout_add_cnt > 0)
+    printf ("Timer: %lld timeouts added, %lld cancelled, %lld called\n",
+            timeout_add_cnt, timeout_cancel_cnt, timeout_call_cnt);
+  if (timer_tickless)
+    printf ("Timer: %lld one-shots covering %lld ticks\n",
+            oneshot_cnt, skipped_cnt);
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
+  if (oneshot_stale)
+    {
+      /* A one-shot whose ticks timer_idle_exit() counted. */
+      oneshot_stale = false;
+      thread_wake (ticks);
+      return;
+    }
+  if (oneshot)
+    {
+      unsigned left;
+      bool expired;
+
+      /* Otherwise this is a periodic interrupt that was pending
+         when the one-shot started, and counts as usual. */
+      left = pit_read_counter (0, &expired);
+      if (expired)
+        {
+          oneshot_end (left, true);
+          thread_wake (ticks);
+          return;
+        }
+    }
+
   ticks++;
+  wheel_count_tick ();
+  thread_wake (ticks);
   thread_tick ();
 }
 
+/* Ends the one-shot, which has LEFT cycles still to count down
+   or, if EXPIRED, has run out and wrapped around to LEFT.  Counts
+   the ticks that passed since it started as idle ticks and
+   restarts the periodic timer. */
+static void
+oneshot_end (unsigned left, bool expired)
+{
+  unsigned elapsed, total;
+
+  if (expired)
+    elapsed = oneshot_cycles + (uint16_t) -left;
+  else
+    elapsed = left < oneshot_cycles ? oneshot_cycles - left : 0;
+  total = oneshot_offset + elapsed;
+
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  oneshot = false;
+  phase = total % TICK_CYCLES;
+
+  for (; total >= TICK_CYCLES; total -= TICK_CYCLES)
+    {
+      ticks++;
+      wheel_count_tick ();
+      skipped_cnt++;
+      thread_idle_tick ();
+    }
+}
+
+/* Puts pending timeout T in its slot of the wheel. */
+static void
+wheel_insert (struct timeout *t)
+{
+  int64_t expires = t->expires;
+  int level;
+
+  if (expires - wheel_tick >= WHEEL_SPAN)
+    expires = wheel_tick + WHEEL_SPAN - 1;
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (expires - wheel_tick < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                % WHEEL_SLOTS], &t->elem);
+  t->in_wheel = true;
+  wheel_cnt++;
+}
+
+/* Lets the wheel know that the tick count went up. */
+static void
+wheel_count_tick (void)
+{
+  if (wheel_cnt == 0)
+    wheel_tick = ticks;
+  else
+    intr_defer (&wheel_work);
+}
+
+/* Brings the wheel up to the tick count: for each tick since it
+   last ran, cascades the slots that are due, then moves the
+   timeouts that expire to expired_list, waking the timeout
+   thread.
+
+   Deferred work queued by the timer interrupt, so that it is not
+   done with interrupts off: they are turned off only to move one
+   timeout at a time.  A timeout added meanwhile never goes into
+   the slot being emptied. */
+static void
+wheel_run (void *aux UNUSED)
+{
+  enum intr_level old_level = intr_disable ();
+
+  while (wheel_tick < ticks)
+    {
+      int64_t t = ++wheel_tick;
+      struct list *slot;
+      int level;
+
+      for (level = 1; level < WHEEL_LEVELS; level++)
+        {
+          if ((t >> (WHEEL_BITS * (level - 1))) % WHEEL_SLOTS != 0)
+            break;
+          slot = &wheel[level][(t >> (WHEEL_BITS * level)) % WHEEL_SLOTS];
+          while (!list_empty (slot))
+            {
+              struct timeout *to = list_entry (list_pop_front (slot),
+                                               struct timeout, elem);
+              to->in_wheel = false;
+              wheel_cnt--;
+              wheel_insert (to);
+              intr_set_level (old_level);
+              intr_disable ();
+            }
+        }
+
+      slot = &wheel[0][t % WHEEL_SLOTS];
+      while (!list_empty (slot))
+        {
+          struct timeout *to = list_entry (list_pop_front (slot),
+                                           struct timeout, elem);
+          if (list_empty (&expired_list))
+            sema_up (&expired_sema);
+          list_push_back (&expired_list, &to->elem);
+          to->in_wheel = false;
+          wheel_cnt--;
+          intr_set_level (old_level);
+          intr_disable ();
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns the first tick after the last one counted, and before
+   LIMIT, at which the wheel may have timeouts to expire, or LIMIT
+   if there is none.  A tick that cascades counts as one that
+   may. */
+static int64_t
+wheel_next (int64_t limit)
+{
+  int64_t t;
+
+  if (wheel_cnt == 0)
+    return limit;
+  for (t = wheel_tick + 1; t < limit; t++)
+    if (t % WHEEL_SLOTS == 0 || !list_empty (&wheel[0][t % WHEEL_SLOTS]))
+      return t;
+  return limit;
+}
+
+/* Calls the functions of expired timeouts, as they expire. */
+static void
+timeout_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      struct timeout *t;
+
+      if (list_empty (&expired_list))
+        {
+          intr_set_level (old_level);
+          sema_down (&expired_sema);
+          continue;
+        }
+      t = list_entry (list_pop_front (&expired_list), struct timeout, elem);
+      t->pending = false;
+      timeout_call_cnt++;
+      intr_set_level (old_level);
+
+      t->function (t->aux);
+    }
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
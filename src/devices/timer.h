@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -24,6 +26,36 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Timeouts: call a function once, a number of ticks from now.
+
+   The function is called by the "timeout" kernel thread, at
+   PRI_MAX and with interrupts on, so unlike an interrupt handler
+   it may block, but it should not block for long because it
+   holds up every other timeout due at the same time. */
+typedef void timeout_func (void *aux);
+
+struct timeout
+  {
+    struct list_elem elem;      /* In a wheel slot or expired list. */
+    int64_t expires;            /* Tick at which it is due. */
+    timeout_func *function;     /* Function to call. */
+    void *aux;                  /* Argument to pass it. */
+    bool pending;               /* Added, and not yet called or cancelled? */
+    bool in_wheel;              /* In a wheel slot, not expired_list? */
+  };
+
+void timeout_init (struct timeout *, timeout_func *, void *aux);
+void timeout_add (struct timeout *, int64_t ticks);
+bool timeout_cancel (struct timeout *);
+bool timeout_pending (const struct timeout *);
+
+void timer_bench (char **argv);
+
+/* Tickless idle. */
+extern bool timer_tickless;
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
@@ -0,0 +1,123 @@
+/* aiobench.c
+
+   Reads a file a chunk at a time and does some computation on
+   each chunk.  Run it with a mode, the file size in kB and the
+   work to do per chunk, e.g. "aiobench async 128 20":
+
+     sync   pread() each chunk, then compute on it.
+     async  Compute on each chunk while aio_submit() reads the
+            next one in the background.
+
+   Both print the same checksum.  The async run also says how
+   often its next chunk had not arrived by the time the
+   computation was done.  Compare the timer ticks printed at
+   shutdown to see how much of the I/O the computation hid. */
+
+#include <aio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+#define CHUNK_SIZE 4096
+
+static char buf[2][CHUNK_SIZE];
+
+/* Returns a checksum of BUFFER, computed WORK times over. */
+static unsigned
+compute (const char *buffer, int work)
+{
+  unsigned sum = 0;
+  int i, w;
+
+  for (w = 0; w < work; w++)
+    for (i = 0; i < CHUNK_SIZE; i++)
+      sum = sum * 31 + buffer[i];
+  return sum;
+}
+
+/* Starts reading chunk C of file FD into its buffer.
+   Returns the request's identifier. */
+static int
+submit (int fd, int c)
+{
+  struct aiocb cb;
+
+  cb.aio_fd = fd;
+  cb.aio_buf = buf[c % 2];
+  cb.aio_nbytes = CHUNK_SIZE;
+  cb.aio_offset = c * CHUNK_SIZE;
+  cb.aio_write = false;
+  return aio_submit (&cb);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int chunk_cnt, work, fd, c, id, stalls;
+  unsigned sum;
+  bool async;
+
+  if (argc != 4 || (strcmp (argv[1], "sync") && strcmp (argv[1], "async")))
+    {
+      printf ("usage: aiobench sync|async KB WORK\n");
+      return EXIT_FAILURE;
+    }
+  async = !strcmp (argv[1], "async");
+  chunk_cnt = atoi (argv[2]) * 1024 / CHUNK_SIZE;
+  work = atoi (argv[3]);
+
+  /* Write the file. */
+  remove ("aiobench.dat");
+  if (!create ("aiobench.dat", 0) || (fd = open ("aiobench.dat")) < 0)
+    {
+      printf ("aiobench.dat: create failed\n");
+      return EXIT_FAILURE;
+    }
+  for (c = 0; c < chunk_cnt; c++)
+    {
+      memset (buf[0], 'a' + c % 26, CHUNK_SIZE);
+      if (write (fd, buf[0], CHUNK_SIZE) != CHUNK_SIZE)
+        {
+          printf ("aiobench.dat: write failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* Read it back and compute. */
+  sum = 0;
+  stalls = 0;
+  id = async && chunk_cnt > 0 ? submit (fd, 0) : -1;
+  for (c = 0; c < chunk_cnt; c++)
+    {
+      int n;
+
+      if (async)
+        {
+          n = aio_poll (id);
+          if (n == AIO_PENDING)
+            {
+              stalls++;
+              n = aio_wait (id);
+            }
+          if (c + 1 < chunk_cnt)
+            id = submit (fd, c + 1);
+        }
+      else
+        n = pread (fd, buf[c % 2], CHUNK_SIZE, c * CHUNK_SIZE);
+      if (n != CHUNK_SIZE || (async && c + 1 < chunk_cnt && id < 0))
+        {
+          printf ("aiobench: chunk %d: read failed\n", c);
+          return EXIT_FAILURE;
+        }
+      sum += compute (buf[c % 2], work);
+    }
+
+  printf ("aiobench: %s: %d chunks, checksum %08x", argv[1], chunk_cnt, sum);
+  if (async)
+    printf (", waited for %d", stalls);
+  printf ("\n");
+
+  close (fd);
+  return EXIT_SUCCESS;
+}
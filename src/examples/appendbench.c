@@ -0,0 +1,74 @@
+/* appendbench.c
+
+   Appends to several files at once, a small piece to each in
+   turn, which scatters the files' sectors unless allocation is
+   delayed.  Run it with the number of files and the number of
+   kilobytes to append to each, e.g. "appendbench 4 64", followed
+   by the `frag' action to see how the files were laid out.  With
+   -p, space for each file is reserved with fallocate() first. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+#define MAX_FILES 16
+#define CHUNK 100
+
+int
+main (int argc, char *argv[])
+{
+  int fds[MAX_FILES];
+  char name[16], chunk[CHUNK];
+  bool prealloc = false;
+  int file_cnt, size, written, i;
+
+  if (argc > 1 && !strcmp (argv[1], "-p"))
+    {
+      prealloc = true;
+      argc--;
+      argv++;
+    }
+  if (argc != 3)
+    {
+      printf ("usage: appendbench [-p] FILES KB\n");
+      return EXIT_FAILURE;
+    }
+  file_cnt = atoi (argv[1]);
+  size = atoi (argv[2]) * 1024;
+  if (file_cnt < 1 || file_cnt > MAX_FILES)
+    {
+      printf ("appendbench: FILES must be between 1 and %d\n", MAX_FILES);
+      return EXIT_FAILURE;
+    }
+
+  for (i = 0; i < file_cnt; i++)
+    {
+      snprintf (name, sizeof name, "append%d", i);
+      remove (name);
+      if (!create (name, 0) || (fds[i] = open (name)) < 0)
+        {
+          printf ("%s: create failed\n", name);
+          return EXIT_FAILURE;
+        }
+      if (prealloc && !fallocate (fds[i], size))
+        {
+          printf ("%s: fallocate failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+
+  memset (chunk, 'a', sizeof chunk);
+  for (written = 0; written < size; written += CHUNK)
+    for (i = 0; i < file_cnt; i++)
+      if (write (fds[i], chunk, CHUNK) != CHUNK)
+        {
+          printf ("append%d: write failed\n", i);
+          return EXIT_FAILURE;
+        }
+
+  for (i = 0; i < file_cnt; i++)
+    close (fds[i]);
+  printf ("appendbench: appended %d bytes to %d files\n", written, file_cnt);
+  return EXIT_SUCCESS;
+}
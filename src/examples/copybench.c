@@ -0,0 +1,107 @@
+/* copybench.c
+
+   Copies a file several times over, either with the copy_file()
+   system call or, with -u, by reading and writing it through a
+   buffer in this process, as cp used to.  Run it with the size of
+   the file in kilobytes and the number of copies to make, e.g.
+   "copybench 256 8" against "copybench -u 256 8", and compare the
+   timer ticks and system call counts printed at shutdown. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+static char buffer[1024];
+
+/* Copies everything from IN_FD to OUT_FD through BUFFER.
+   Returns the number of bytes copied. */
+static int
+copy_user (int in_fd, int out_fd)
+{
+  int total = 0;
+
+  for (;;)
+    {
+      int bytes_read = read (in_fd, buffer, sizeof buffer);
+      if (bytes_read <= 0 || write (out_fd, buffer, bytes_read) != bytes_read)
+        break;
+      total += bytes_read;
+    }
+  return total;
+}
+
+int
+main (int argc, char *argv[])
+{
+  bool user = false;
+  int size, copy_cnt, in_fd, out_fd, i;
+
+  if (argc > 1 && !strcmp (argv[1], "-u"))
+    {
+      user = true;
+      argc--;
+      argv++;
+    }
+  if (argc != 3)
+    {
+      printf ("usage: copybench [-u] KB COPIES\n");
+      return EXIT_FAILURE;
+    }
+  size = atoi (argv[1]) * 1024;
+  copy_cnt = atoi (argv[2]);
+
+  /* Make the source file. */
+  remove ("copy.src");
+  if (!create ("copy.src", 0) || (in_fd = open ("copy.src")) < 0)
+    {
+      printf ("copy.src: create failed\n");
+      return EXIT_FAILURE;
+    }
+  for (i = 0; i < size; i += sizeof buffer)
+    {
+      memset (buffer, 'a' + i / (int) sizeof buffer % 26, sizeof buffer);
+      if (write (in_fd, buffer, sizeof buffer) != sizeof buffer)
+        {
+          printf ("copy.src: write failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* Copy it. */
+  for (i = 0; i < copy_cnt; i++)
+    {
+      int copied;
+
+      remove ("copy.dst");
+      if (!create ("copy.dst", 0) || (out_fd = open ("copy.dst")) < 0)
+        {
+          printf ("copy.dst: create failed\n");
+          return EXIT_FAILURE;
+        }
+      seek (in_fd, 0);
+      copied = user ? copy_user (in_fd, out_fd) : copy_file (in_fd, out_fd, size);
+      if (copied != size)
+        {
+          printf ("copy.dst: copied %d bytes of %d\n", copied, size);
+          return EXIT_FAILURE;
+        }
+
+      /* Spot-check the last kilobyte. */
+      if (pread (out_fd, buffer, sizeof buffer, size - sizeof buffer)
+          != sizeof buffer
+          || buffer[0] != 'a' + (size / (int) sizeof buffer - 1) % 26)
+        {
+          printf ("copy.dst: wrong data\n");
+          return EXIT_FAILURE;
+        }
+      close (out_fd);
+    }
+  printf ("copybench: %s: copied %d bytes %d times\n",
+          user ? "read/write" : "copy_file", size, copy_cnt);
+
+  close (in_fd);
+  remove ("copy.src");
+  remove ("copy.dst");
+  return EXIT_SUCCESS;
+}
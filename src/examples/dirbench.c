@@ -0,0 +1,81 @@
+/* dirbench.c
+
+   Creates, opens and removes many files in the root directory,
+   to measure the cost of directory lookups.  Run it with the
+   number of files to use, e.g. "dirbench 1500", and compare the
+   sector read counts printed at shutdown. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+int
+main (int argc, char *argv[])
+{
+  char name[16];
+  int file_cnt = 1000;
+  int i;
+
+  if (argc > 2)
+    {
+      printf ("usage: dirbench [COUNT]\n");
+      return EXIT_FAILURE;
+    }
+  if (argc == 2)
+    file_cnt = atoi (argv[1]);
+
+  /* Create. */
+  for (i = 0; i < file_cnt; i++)
+    {
+      snprintf (name, sizeof name, "db%d", i);
+      if (!create (name, 0))
+        {
+          printf ("%s: create failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+  printf ("dirbench: created %d files\n", file_cnt);
+
+  /* Open, in reverse order so that nothing benefits from the
+     files having just been created. */
+  for (i = file_cnt - 1; i >= 0; i--)
+    {
+      int fd;
+
+      snprintf (name, sizeof name, "db%d", i);
+      fd = open (name);
+      if (fd < 0)
+        {
+          printf ("%s: open failed\n", name);
+          return EXIT_FAILURE;
+        }
+      close (fd);
+    }
+  printf ("dirbench: opened %d files\n", file_cnt);
+
+  /* Look up names that do not exist. */
+  for (i = 0; i < file_cnt; i++)
+    {
+      snprintf (name, sizeof name, "nx%d", i);
+      if (open (name) >= 0)
+        {
+          printf ("%s: open should have failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+  printf ("dirbench: missed %d files\n", file_cnt);
+
+  /* Remove. */
+  for (i = 0; i < file_cnt; i++)
+    {
+      snprintf (name, sizeof name, "db%d", i);
+      if (!remove (name))
+        {
+          printf ("%s: remove failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+  printf ("dirbench: removed %d files\n", file_cnt);
+
+  return EXIT_SUCCESS;
+}
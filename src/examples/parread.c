@@ -0,0 +1,111 @@
+/* parread.c
+
+   Starts several processes that all read the same file at once,
+   to measure how well file reads by independent processes
+   proceed in parallel.  Run it with the number of readers and,
+   optionally, the number of times each reads the file, e.g.
+   "parread 4 8", and compare the timer ticks printed at shutdown
+   against a run with a single reader doing the same total
+   work. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+#define FILE_NAME "parread.dat"
+#define FILE_SIZE (64 * 1024)
+#define MAX_READERS 16
+
+static char buf[4096];
+
+/* Reads FILE_NAME from start to end PASSES times. */
+static int
+reader (int passes)
+{
+  int fd = open (FILE_NAME);
+  int i;
+
+  if (fd < 0)
+    {
+      printf ("parread: open failed\n");
+      return EXIT_FAILURE;
+    }
+  for (i = 0; i < passes; i++)
+    {
+      int total = 0;
+      int n;
+
+      seek (fd, 0);
+      while ((n = read (fd, buf, sizeof buf)) > 0)
+        total += n;
+      if (total != FILE_SIZE)
+        {
+          printf ("parread: short read (%d bytes)\n", total);
+          return EXIT_FAILURE;
+        }
+    }
+  close (fd);
+  return EXIT_SUCCESS;
+}
+
+int
+main (int argc, char *argv[])
+{
+  pid_t children[MAX_READERS];
+  char cmd[32];
+  int reader_cnt, passes = 4;
+  int fd, i, status = EXIT_SUCCESS;
+
+  /* A child started below. */
+  if (argc == 3 && !strcmp (argv[1], "-r"))
+    return reader (atoi (argv[2]));
+
+  if (argc < 2 || argc > 3)
+    {
+      printf ("usage: parread READERS [PASSES]\n");
+      return EXIT_FAILURE;
+    }
+  reader_cnt = atoi (argv[1]);
+  if (argc == 3)
+    passes = atoi (argv[2]);
+  if (reader_cnt < 1 || reader_cnt > MAX_READERS)
+    {
+      printf ("parread: READERS must be between 1 and %d\n", MAX_READERS);
+      return EXIT_FAILURE;
+    }
+
+  /* Create the file to read. */
+  remove (FILE_NAME);
+  if (!create (FILE_NAME, FILE_SIZE) || (fd = open (FILE_NAME)) < 0)
+    {
+      printf ("parread: can't create %s\n", FILE_NAME);
+      return EXIT_FAILURE;
+    }
+  memset (buf, 'x', sizeof buf);
+  for (i = 0; i < FILE_SIZE / (int) sizeof buf; i++)
+    write (fd, buf, sizeof buf);
+  close (fd);
+
+  /* Start the readers, then wait for all of them. */
+  snprintf (cmd, sizeof cmd, "parread -r %d", passes);
+  for (i = 0; i < reader_cnt; i++)
+    {
+      children[i] = exec (cmd);
+      if (children[i] == PID_ERROR)
+        {
+          printf ("parread: exec failed\n");
+          reader_cnt = i;
+          status = EXIT_FAILURE;
+          break;
+        }
+    }
+  for (i = 0; i < reader_cnt; i++)
+    if (wait (children[i]) != EXIT_SUCCESS)
+      status = EXIT_FAILURE;
+
+  printf ("parread: %d readers read %d KB each\n",
+          reader_cnt, passes * FILE_SIZE / 1024);
+  remove (FILE_NAME);
+  return status;
+}
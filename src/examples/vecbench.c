@@ -0,0 +1,159 @@
+/* vecbench.c
+
+   Writes a file of fixed-size records, each made up of several
+   fields kept in separate buffers, then reads them back into the
+   same buffers and checks them.  Run it with a mode and the
+   number of records, e.g. "vecbench vec 200":
+
+     seek  seek() to each field, then read() or write() it.
+     pos   pread() or pwrite() each field at its offset.
+     vec   readv() or writev() each whole record at once.
+
+   It prints how many system calls each pass took; the total for
+   the run is printed at shutdown. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Fields of a record. */
+#define FIELD_CNT 4
+static const unsigned field_size[FIELD_CNT] = {8, 16, 64, 8};
+#define RECORD_SIZE 96
+
+static char fields[FIELD_CNT][64];
+static struct iovec iov[FIELD_CNT];
+
+/* Fills in the fields of record R. */
+static void
+fill (int r)
+{
+  int i;
+
+  for (i = 0; i < FIELD_CNT; i++)
+    memset (fields[i], 'a' + (r + i) % 26, field_size[i]);
+}
+
+/* Returns true if the fields hold record R. */
+static bool
+check (int r)
+{
+  unsigned i, j;
+
+  for (i = 0; i < FIELD_CNT; i++)
+    for (j = 0; j < field_size[i]; j++)
+      if (fields[i][j] != 'a' + (r + (int) i) % 26)
+        return false;
+  return true;
+}
+
+/* Transfers record R of file FD in MODE, writing if WRITING is
+   true and reading otherwise.  Returns the number of system calls
+   made, or -1 on failure. */
+static int
+transfer (int fd, const char *mode, int r, bool writing)
+{
+  unsigned ofs = r * RECORD_SIZE;
+  int calls = 0;
+  int i;
+
+  if (!strcmp (mode, "vec"))
+    {
+      int n = (writing
+               ? writev (fd, iov, FIELD_CNT) : readv (fd, iov, FIELD_CNT));
+      return n == RECORD_SIZE ? 1 : -1;
+    }
+
+  for (i = 0; i < FIELD_CNT; i++)
+    {
+      int n;
+
+      if (!strcmp (mode, "pos"))
+        n = (writing
+             ? pwrite (fd, fields[i], field_size[i], ofs)
+             : pread (fd, fields[i], field_size[i], ofs));
+      else
+        {
+          seek (fd, ofs);
+          calls++;
+          n = (writing
+               ? write (fd, fields[i], field_size[i])
+               : read (fd, fields[i], field_size[i]));
+        }
+      calls++;
+      if (n != (int) field_size[i])
+        return -1;
+      ofs += field_size[i];
+    }
+  return calls;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *mode;
+  int record_cnt, calls, fd, r, i;
+
+  if (argc != 3 || (strcmp (argv[1], "seek") && strcmp (argv[1], "pos")
+                    && strcmp (argv[1], "vec")))
+    {
+      printf ("usage: vecbench seek|pos|vec RECORDS\n");
+      return EXIT_FAILURE;
+    }
+  mode = argv[1];
+  record_cnt = atoi (argv[2]);
+
+  for (i = 0; i < FIELD_CNT; i++)
+    {
+      iov[i].iov_base = fields[i];
+      iov[i].iov_len = field_size[i];
+    }
+
+  remove ("vecbench.dat");
+  if (!create ("vecbench.dat", 0) || (fd = open ("vecbench.dat")) < 0)
+    {
+      printf ("vecbench.dat: create failed\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Write. */
+  calls = 0;
+  for (r = 0; r < record_cnt; r++)
+    {
+      int n;
+
+      fill (r);
+      n = transfer (fd, mode, r, true);
+      if (n < 0)
+        {
+          printf ("vecbench: record %d: write failed\n", r);
+          return EXIT_FAILURE;
+        }
+      calls += n;
+    }
+  printf ("vecbench: %s: wrote %d records in %d calls\n",
+          mode, record_cnt, calls);
+
+  /* Read back. */
+  calls = 0;
+  seek (fd, 0);
+  for (r = 0; r < record_cnt; r++)
+    {
+      int n;
+
+      memset (fields, 0, sizeof fields);
+      n = transfer (fd, mode, r, false);
+      if (n < 0 || !check (r))
+        {
+          printf ("vecbench: record %d: read failed\n", r);
+          return EXIT_FAILURE;
+        }
+      calls += n;
+    }
+  printf ("vecbench: %s: read %d records in %d calls\n",
+          mode, record_cnt, calls);
+
+  close (fd);
+  return EXIT_SUCCESS;
+}
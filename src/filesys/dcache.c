@@ -0,0 +1,196 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Name lookup cache.
+
+   Maps a (directory inode sector, name) pair to the sector of
+   the inode that the name refers to, so that resolving the same
+   name over and over does not have to read the directory.  Names
+   that were looked up and not found are cached too, as negative
+   entries, because failed opens of the same name are just as
+   common.
+
+   The directory code keeps the cache coherent: dir_add() and
+   dir_remove() update the entry for the name they change.  The
+   cache holds at most DCACHE_SIZE entries and evicts the least
+   recently used one when full. */
+
+/* Maximum number of cached names. */
+#define DCACHE_SIZE 64
+
+/* A cached name. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in `dentries'. */
+    struct list_elem lru_elem;          /* Element in `lru'. */
+    block_sector_t dir_sector;          /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Inode, or DCACHE_NEGATIVE. */
+  };
+
+static struct hash dentries;            /* All cached names. */
+static struct list lru;                 /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Positive hits. */
+static long long negative_hit_cnt;      /* Negative hits. */
+static long long miss_cnt;              /* Names not in the cache. */
+
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+static struct dcache_entry *find (block_sector_t, const char *);
+
+/* Initializes the name lookup cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dcache_hash, dcache_less, NULL);
+  list_init (&lru);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in DIR_SECTOR.
+   Returns false if the cache knows nothing about NAME.
+   Otherwise returns true and sets *INODE_SECTOR to the sector of
+   NAME's inode, or to DCACHE_NEGATIVE if NAME does not exist. */
+bool
+dcache_lookup (block_sector_t dir_sector, const char *name,
+               block_sector_t *inode_sector)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = find (dir_sector, name);
+  if (e != NULL)
+    {
+      list_remove (&e->lru_elem);
+      list_push_front (&lru, &e->lru_elem);
+      *inode_sector = e->inode_sector;
+      if (e->inode_sector != DCACHE_NEGATIVE)
+        hit_cnt++;
+      else
+        negative_hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return e != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in
+   DIR_SECTOR refers to the inode in INODE_SECTOR, or, if
+   INODE_SECTOR is DCACHE_NEGATIVE, that NAME does not exist. */
+void
+dcache_insert (block_sector_t dir_sector, const char *name,
+               block_sector_t inode_sector)
+{
+  struct dcache_entry *e;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  e = find (dir_sector, name);
+  if (e != NULL)
+    list_remove (&e->lru_elem);
+  else
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        {
+          /* Recycle the least recently used entry. */
+          e = list_entry (list_pop_back (&lru), struct dcache_entry,
+                          lru_elem);
+          hash_delete (&dentries, &e->hash_elem);
+        }
+      else
+        {
+          e = malloc (sizeof *e);
+          if (e == NULL)
+            {
+              lock_release (&dcache_lock);
+              return;
+            }
+        }
+      e->dir_sector = dir_sector;
+      strlcpy (e->name, name, sizeof e->name);
+      hash_insert (&dentries, &e->hash_elem);
+    }
+  e->inode_sector = inode_sector;
+  list_push_front (&lru, &e->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets anything cached about NAME in the directory whose
+   inode is in DIR_SECTOR. */
+void
+dcache_invalidate (block_sector_t dir_sector, const char *name)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = find (dir_sector, name);
+  if (e != NULL)
+    {
+      hash_delete (&dentries, &e->hash_elem);
+      list_remove (&e->lru_elem);
+      free (e);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints name lookup cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Name cache: %lld hits, %lld negative hits, %lld misses\n",
+          hit_cnt, negative_hit_cnt, miss_cnt);
+}
+
+/* Returns the entry for NAME in the directory whose inode is in
+   DIR_SECTOR, or a null pointer if there is none.
+   dcache_lock must be held. */
+static struct dcache_entry *
+find (block_sector_t dir_sector, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir_sector = dir_sector;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Returns a hash value for dcache_entry E. */
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dcache_entry *d = hash_entry (e, struct dcache_entry,
+                                             hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir_sector);
+}
+
+/* Returns true if dcache_entry A precedes dcache_entry B. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->dir_sector != b->dir_sector)
+    return a->dir_sector < b->dir_sector;
+  return strcmp (a->name, b->name) < 0;
+}
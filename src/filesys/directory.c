@@ -2,8 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
@@ -21,12 +25,89 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Most buckets dir_add() marks as overflowed, so that adding a
+   name stays within a transaction's room in the journal. */
+#define DIR_OVERFLOW_MAX 5
+
+/* Number of directory entries that fit in one hash bucket. */
+#define DIR_BUCKET_ENTRIES \
+  ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) / sizeof (struct dir_entry))
+
+/* A hash bucket of a directory.
+
+   A directory file is an array of buckets, each exactly one
+   sector long.  A name is stored in the bucket selected by its
+   hash or, if that bucket is full, in the next bucket (wrapping
+   around) that has a free slot.  Every bucket passed over while
+   looking for a free slot is marked as overflowed, so a lookup
+   only has to probe further than the home bucket of a name when
+   that bucket has overflowed at some point.  In the common case
+   finding a name therefore costs exactly one sector read. */
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];  /* Entries. */
+    uint32_t overflow;                  /* Probing must go past us? */
+    uint8_t unused[BLOCK_SECTOR_SIZE
+                   - DIR_BUCKET_ENTRIES * sizeof (struct dir_entry)
+                   - sizeof (uint32_t)];   /* Not used. */
+  };
+
+static bool mark_overflow (struct dir *, const char *name, size_t idx);
+
+/* Returns the number of hash buckets in DIR. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  return inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of bucket IDX within a directory file. */
+static inline off_t
+bucket_ofs (size_t idx)
+{
+  return idx * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the home bucket of NAME in DIR. */
+static size_t
+bucket_of (const struct dir *dir, const char *name)
+{
+  return hash_string (name) % bucket_cnt (dir);
+}
+
+/* Reads bucket IDX of DIR into B.
+   Returns true if successful, false on a short read. */
+static bool
+read_bucket (const struct dir *dir, size_t idx, struct dir_bucket *b)
+{
+  return inode_read_at (dir->inode, b, sizeof *b, bucket_ofs (idx))
+         == sizeof *b;
+}
+
+/* Writes B to bucket IDX of DIR.
+   Returns true if successful, false on a short write. */
+static bool
+write_bucket (struct dir *dir, size_t idx, const struct dir_bucket *b)
+{
+  return inode_write_at (dir->inode, b, sizeof *b, bucket_ofs (idx))
+         == sizeof *b;
+}
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR.  Returns true if successful, false on failure.
+   The space is rounded up to a whole number of hash buckets and
+   is fixed for the lifetime of the directory. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t buckets = DIV_ROUND_UP (entry_cnt, DIR_BUCKET_ENTRIES);
+
+  /* If this assertion fails, a bucket is not exactly one sector
+     in size. */
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  if (buckets == 0)
+    buckets = 1;
+  return inode_create (sector, buckets * BLOCK_SECTOR_SIZE, true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,32 +164,63 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Result of lookup(). */
+enum lookup_result
+  {
+    LOOKUP_FOUND,               /* NAME is in the directory. */
+    LOOKUP_MISSING,             /* NAME is not in the directory. */
+    LOOKUP_ERROR                /* A disk or memory error occurred. */
+  };
+
 /* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
+   If successful, returns LOOKUP_FOUND, sets *EP to the directory
+   entry if EP is non-null, and sets *OFSP to the byte offset of
+   the directory entry if OFSP is non-null.
+   Otherwise, returns LOOKUP_MISSING if every bucket NAME could be
+   in was read and it was not there, or LOOKUP_ERROR if a bucket
+   could not be read, and ignores EP and OFSP. */
+static enum lookup_result
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  struct dir_bucket *b;
+  size_t cnt, idx, probes;
+  enum lookup_result result = LOOKUP_MISSING;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return LOOKUP_ERROR;
+
+  cnt = bucket_cnt (dir);
+  idx = bucket_of (dir, name);
+  for (probes = 0; result == LOOKUP_MISSING && probes < cnt; probes++)
+    {
+      size_t i;
+
+      if (!read_bucket (dir, idx, b))
+        {
+          result = LOOKUP_ERROR;
+          break;
+        }
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (b->entries[i].in_use && !strcmp (name, b->entries[i].name))
+          {
+            if (ep != NULL)
+              *ep = b->entries[i];
+            if (ofsp != NULL)
+              *ofsp = bucket_ofs (idx) + i * sizeof (struct dir_entry);
+            result = LOOKUP_FOUND;
+            break;
+          }
+      if (!b->overflow)
+        break;
+      idx = (idx + 1) % cnt;
+    }
+  free (b);
+  return result;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -119,15 +231,41 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, inode_sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  /* Holding the directory lock until the inode is open keeps a
+     concurrent dir_remove() from freeing it underneath us. */
+  inode_lock_dir (dir->inode, false);
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &inode_sector))
+    {
+      /* Only remember that NAME is missing if every bucket it
+         could be in was actually read. */
+      switch (lookup (dir, name, &e, NULL))
+        {
+        case LOOKUP_FOUND:
+          inode_sector = e.inode_sector;
+          dcache_insert (dir_sector, name, inode_sector);
+          break;
+        case LOOKUP_MISSING:
+          inode_sector = DCACHE_NEGATIVE;
+          dcache_insert (dir_sector, name, inode_sector);
+          break;
+        case LOOKUP_ERROR:
+          inode_sector = DCACHE_NEGATIVE;
+          break;
+        }
+    }
+
+  if (inode_sector != DCACHE_NEGATIVE)
+    *inode = inode_open (inode_sector);
   else
     *inode = NULL;
+  inode_unlock_dir (dir->inode, false);
 
   return *inode != NULL;
 }
@@ -136,13 +274,15 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if more than
+   DIR_OVERFLOW_MAX buckets would have to be marked as overflowed,
+   or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
-  off_t ofs;
+  block_sector_t dir_sector, cached;
+  struct dir_bucket *b;
+  size_t cnt, idx, probes, marks;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +292,63 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  inode_lock_dir (dir->inode, true);
+
+  /* Check that NAME is not in use, trusting the name cache if it
+     knows either way. */
+  dir_sector = inode_get_inumber (dir->inode);
+  if (dcache_lookup (dir_sector, name, &cached))
+    {
+      if (cached != DCACHE_NEGATIVE)
+        goto done;
+    }
+  else if (lookup (dir, name, NULL, NULL) != LOOKUP_MISSING)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  /* Probe forward from NAME's home bucket for a free slot.  Each
+     full bucket we pass must be marked as overflowed, so that
+     lookup() knows to continue past it, but nothing is written
+     until the slot is found and the marks are known to be few
+     enough. */
+  cnt = bucket_cnt (dir);
+  idx = bucket_of (dir, name);
+  marks = 0;
+  for (probes = 0; probes < cnt; probes++)
+    {
+      size_t i;
+
+      if (!read_bucket (dir, idx, b))
+        goto done;
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (!b->entries[i].in_use)
+          break;
+
+      if (i < DIR_BUCKET_ENTRIES)
+        {
+          /* Mark the buckets passed, then write slot. */
+          struct dir_entry *e = &b->entries[i];
+          if (marks > 0 && !mark_overflow (dir, name, idx))
+            goto done;
+          e->in_use = true;
+          strlcpy (e->name, name, sizeof e->name);
+          e->inode_sector = inode_sector;
+          success = write_bucket (dir, idx, b);
+          if (success)
+            dcache_insert (dir_sector, name, inode_sector);
+          goto done;
+        }
+
+      if (!b->overflow && ++marks > DIR_OVERFLOW_MAX)
+        goto done;
+      idx = (idx + 1) % cnt;
+    }
 
  done:
+  inode_unlock_dir (dir->inode, true);
+  free (b);
   return success;
 }
 
@@ -192,8 +366,10 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock_dir (dir->inode, true);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (lookup (dir, name, &e, &ofs) != LOOKUP_FOUND)
     goto done;
 
   /* Open inode. */
@@ -202,35 +378,174 @@ dir_remove (struct dir *dir, const char *name)
     goto done;
 
   /* Erase directory entry. */
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  inode_unlock_dir (dir->inode, true);
   inode_close (inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Entries are returned in bucket
+   order, not in the order they were added. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  inode_lock_dir (dir->inode, false);
+  while (!found)
     {
+      /* Skip the tail of the current bucket. */
+      if (dir->pos % BLOCK_SECTOR_SIZE
+          >= (off_t) (DIR_BUCKET_ENTRIES * sizeof e))
+        dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
+
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
         } 
     }
-  return false;
+  inode_unlock_dir (dir->inode, false);
+  return found;
+}
+
+/* Sets the overflow flag of every bucket of DIR from NAME's home
+   bucket up to, but not including, bucket IDX, so that lookup()
+   probes as far as IDX.  The caller must hold DIR's lock for
+   writing.  Returns true if successful, false on failure. */
+static bool
+mark_overflow (struct dir *dir, const char *name, size_t idx)
+{
+  struct dir_bucket *b;
+  size_t cnt = bucket_cnt (dir);
+  size_t i;
+  bool success = true;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  for (i = bucket_of (dir, name); success && i != idx; i = (i + 1) % cnt)
+    if (!read_bucket (dir, i, b))
+      success = false;
+    else if (!b->overflow)
+      {
+        b->overflow = true;
+        success = write_bucket (dir, i, b);
+      }
+  free (b);
+  return success;
+}
+
+/* If the running transaction, which a repair of DIR is making,
+   ran out of room in the journal, ends it and begins another and
+   returns true.  Otherwise returns false.  The caller must hold
+   DIR's lock for writing, which is released meanwhile. */
+static bool
+restart (struct dir *dir)
+{
+  if (!journal_refused () || journal_nested ())
+    return false;
+  inode_unlock_dir (dir->inode, true);
+  journal_end ();
+  journal_begin ();
+  inode_lock_dir (dir->inode, true);
+  return true;
+}
+
+/* Calls FUNC, passing AUX, for each entry in use in DIR, in
+   bucket order.  NAME is a null pointer if the entry's name is
+   not a valid file name.  REACHABLE is false if looking up NAME
+   would not find the entry, because an overflow flag is missing
+   on the way to it or because an earlier entry has the same name.
+   If REPAIR is true, entries for which FUNC returns false are
+   erased, and the missing overflow flags of the others are set.
+   For use by the consistency checker. */
+void
+dir_check (struct dir *dir, bool repair, dir_check_func *func, void *aux)
+{
+  block_sector_t dir_sector = inode_get_inumber (dir->inode);
+  struct dir_bucket *b;
+  size_t cnt, idx;
+  bool ok = true;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return;
+  cnt = bucket_cnt (dir);
+  for (idx = 0; ok && idx < cnt; idx++)
+    {
+      size_t i;
+
+      /* Repairs are made one bucket per transaction, so that no
+         transaction outgrows the journal. */
+      if (repair)
+        journal_begin ();
+      inode_lock_dir (dir->inode, true);
+      ok = read_bucket (dir, idx, b);
+      for (i = 0; ok && i < DIR_BUCKET_ENTRIES; i++)
+        {
+          struct dir_entry *e = &b->entries[i];
+          off_t ofs = bucket_ofs (idx) + i * sizeof *e;
+          const char *name = NULL;
+          bool reachable = false;
+          off_t found_ofs;
+
+          if (!e->in_use)
+            continue;
+          if (e->name[0] != '\0' && memchr (e->name, '\0', sizeof e->name))
+            {
+              enum lookup_result result;
+
+              name = e->name;
+              result = lookup (dir, name, NULL, &found_ofs);
+              if (result == LOOKUP_ERROR)
+                {
+                  ok = false;
+                  break;
+                }
+              reachable = result == LOOKUP_FOUND && found_ofs == ofs;
+            }
+
+          if (!func (name, e->inode_sector, reachable, aux))
+            {
+              if (!repair)
+                continue;
+              if (name != NULL)
+                dcache_invalidate (dir_sector, name);
+              e->in_use = false;
+              ok = inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+              while (!ok && restart (dir))
+                ok = inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+            }
+          else if (!reachable && name != NULL && repair)
+            {
+              /* A long run of buckets may take several
+                 transactions to mark. */
+              dcache_invalidate (dir_sector, name);
+              ok = mark_overflow (dir, name, idx);
+              while (!ok && restart (dir))
+                ok = mark_overflow (dir, name, idx);
+            }
+        }
+      inode_unlock_dir (dir->inode, true);
+      if (repair)
+        journal_end ();
+    }
+  free (b);
 }
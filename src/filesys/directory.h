@@ -27,4 +27,9 @@ bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
 
+/* Consistency checking. */
+typedef bool dir_check_func (const char *name, block_sector_t,
+                             bool reachable, void *aux);
+void dir_check (struct dir *, bool repair, dir_check_func *, void *aux);
+
 #endif /* filesys/directory.h */
@@ -1,5 +1,6 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
@@ -113,6 +114,52 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC, starting at its current
+   position, to DST, starting at its current position.  The data
+   moves a sector at a time through a kernel buffer, so none of it
+   passes through user memory.
+   Returns the number of bytes actually copied, which may be less
+   than SIZE if end of SRC is reached or DST cannot grow.
+   Advances both files' positions by the number of bytes copied.
+   DST and SRC must not be open on the same inode. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  uint8_t *buffer;
+  off_t bytes_copied = 0;
+
+  ASSERT (dst != NULL);
+  ASSERT (src != NULL);
+  ASSERT (dst->inode != src->inode);
+
+  buffer = malloc (BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    return 0;
+  while (size > 0)
+    {
+      /* Stop at the end of SRC's current sector, so that whole
+         sectors are read straight into the buffer. */
+      off_t chunk = BLOCK_SECTOR_SIZE - src->pos % BLOCK_SECTOR_SIZE;
+      off_t bytes_read, bytes_written;
+
+      if (chunk > size)
+        chunk = size;
+      bytes_read = inode_read_at (src->inode, buffer, chunk, src->pos);
+      if (bytes_read == 0)
+        break;
+      bytes_written = inode_write_at (dst->inode, buffer, bytes_read,
+                                      dst->pos);
+      src->pos += bytes_written;
+      dst->pos += bytes_written;
+      bytes_copied += bytes_written;
+      size -= bytes_written;
+      if (bytes_written < bytes_read)
+        break;
+    }
+  free (buffer);
+  return bytes_copied;
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -140,6 +187,27 @@ file_allow_write (struct file *file)
     }
 }
 
+/* Reserves disk space for the first SIZE bytes of FILE without
+   changing its length.
+   Returns true if successful, false if SIZE is out of range or
+   the disk is full. */
+bool
+file_allocate (struct file *file, off_t size) 
+{
+  ASSERT (file != NULL);
+  return inode_allocate (file->inode, size);
+}
+
+/* Writes everything written to FILE so far to disk.
+   Returns true if successful, false if some of it was lost
+   because the disk is full. */
+bool
+file_sync (struct file *file) 
+{
+  ASSERT (file != NULL);
+  return inode_sync (file->inode);
+}
+
 /* Returns the size of FILE in bytes. */
 off_t
 file_length (struct file *file)
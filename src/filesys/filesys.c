@@ -2,15 +2,38 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Number of entries the root directory has room for.  The root
+   directory is a fixed-size hash table, so this is a hard limit
+   on the number of files in the file system. */
+#define ROOT_DIR_ENTRIES 2048
+
+/* Data and metadata that have been dirty for this many
+   milliseconds are written back by the flusher.  Zero
+   disables the flusher, leaving them in memory until a sync,
+   until the file is closed, or until the journal fills up. */
+int filesys_flush_ms = 5000;
+
+/* The flusher, work that runs twice per flush interval on its
+   own workqueue, and the flush interval in timer ticks. */
+static struct workqueue *flusher_wq;
+static struct work flusher_work;
+static int64_t flush_age;
+
 static void do_format (void);
+static work_func flusher;
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -22,12 +45,26 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dcache_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
 
   free_map_open ();
+
+  if (filesys_flush_ms > 0)
+    {
+      flush_age = (int64_t) filesys_flush_ms * TIMER_FREQ / 1000;
+      if (flush_age < 2)
+        flush_age = 2;
+      flusher_wq = workqueue_create ("flusher", 1, PRI_DEFAULT);
+      if (flusher_wq == NULL)
+        PANIC ("couldn't start flusher");
+      work_init (&flusher_work, flusher, NULL);
+      queue_delayed_work (flusher_wq, &flusher_work, flush_age / 2);
+    }
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,7 +72,29 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  filesys_sync ();
   free_map_close ();
+  journal_done ();
+}
+
+/* Writes all buffered file data and all pending metadata to
+   disk. */
+void
+filesys_sync (void) 
+{
+  inode_flush_dirty (INT64_MAX);
+  journal_flush ();
+}
+
+/* Flusher.  Writes back whatever has been dirty for longer than
+   the flush interval, then queues itself to run again half an
+   interval later. */
+static void
+flusher (void *aux UNUSED) 
+{
+  inode_flush_dirty (timer_ticks () - flush_age);
+  journal_flush_before (timer_ticks () - flush_age);
+  queue_delayed_work (flusher_wq, &flusher_work, flush_age / 2);
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -47,12 +106,16 @@ filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  bool success;
+
+  journal_begin ();
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector, false)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  journal_end ();
   dir_close (dir);
 
   return success;
@@ -84,7 +147,18 @@ bool
 filesys_remove (const char *name) 
 {
   struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct inode *inode = NULL;
+  bool success;
+
+  /* Holding a reference of our own keeps the last close, which
+     frees the file's sectors in transactions of its own, out of
+     the transaction that removes the name. */
+  if (dir != NULL)
+    dir_lookup (dir, name, &inode);
+  journal_begin ();
+  success = dir != NULL && dir_remove (dir, name);
+  journal_end ();
+  inode_close (inode);
   dir_close (dir); 
 
   return success;
@@ -96,8 +170,10 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  journal_begin ();
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_ENTRIES))
     PANIC ("root directory creation failed");
+  journal_end ();
   free_map_close ();
   printf ("done.\n");
 }
@@ -4,49 +4,224 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *released;      /* Freed since the last commit. */
+static size_t unused_cnt;            /* Free sectors not in RELEASED. */
+static size_t reserved_cnt;          /* Of those, sectors set aside. */
+static struct lock free_map_lock;    /* Protects the above and the file. */
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  released = bitmap_create (block_size (fs_device));
+  if (free_map == NULL || released == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  unused_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+}
+
+/* Returns true if CNT sectors may be allocated, drawing on the
+   sectors set aside by free_map_reserve() if RESERVED is true or
+   leaving them alone if not.  The caller must hold
+   free_map_lock. */
+static bool
+may_allocate (size_t cnt, bool reserved)
+{
+  if (reserved)
+    {
+      ASSERT (reserved_cnt >= cnt);
+      return true;
+    }
+  return unused_cnt - reserved_cnt >= cnt;
+}
+
+/* Accounts for CNT sectors just allocated, drawing on the
+   sectors set aside if RESERVED is true.  The caller must hold
+   free_map_lock. */
+static void
+count_allocated (size_t cnt, bool reserved)
+{
+  unused_cnt -= cnt;
+  if (reserved)
+    reserved_cnt -= cnt;
+}
+
+/* Returns the first of CNT consecutive sectors that are free and
+   were not released since the last journal commit, or
+   BITMAP_ERROR if there are none.  Until the release is committed
+   a crash would undo it, so reusing such a sector could
+   overwrite data that still belongs to the old file. */
+static size_t
+scan_free (size_t cnt)
+{
+  size_t start = 0;
+
+  for (;;)
+    {
+      size_t sector = bitmap_scan (free_map, start, cnt, false);
+      if (sector == BITMAP_ERROR || bitmap_none (released, sector, cnt))
+        return sector;
+      start = sector + 1;
+    }
+}
+
+/* Marks the CNT sectors starting at SECTOR as in use if USED is
+   true, or as free if not, and writes the part of the free map
+   file that holds them, if it is open, within the running
+   transaction.  Returns true if successful.  If the journal
+   refuses the write, puts the bits back as they were and returns
+   false.  The caller must hold free_map_lock. */
+static bool
+set_bits (block_sector_t sector, size_t cnt, bool used)
+{
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  if (free_map_file == NULL
+      || bitmap_write_part (free_map, free_map_file, sector, cnt))
+    return true;
+
+  /* The sectors of the file that were written are now in the
+     batch, so writing them again to undo the change succeeds.
+     The rest were never logged. */
+  bitmap_set_multiple (free_map, sector, cnt, !used);
+  bitmap_write_part (free_map, free_map_file, sector, cnt);
+  return false;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  If RESERVED is true, the sectors come
+   out of those set aside by an earlier free_map_reserve(), of
+   which there must be at least CNT.  Otherwise sectors set aside
+   are left alone.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if the journal had no room to log
+   the change. */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (size_t cnt, block_sector_t *sectorp, bool reserved)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (may_allocate (cnt, reserved))
+    sector = scan_free (cnt);
+  if (sector != BITMAP_ERROR && !set_bits (sector, cnt, true))
+    sector = BITMAP_ERROR;
+  if (sector != BITMAP_ERROR)
+    count_allocated (cnt, reserved);
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
-void
+/* Allocates the CNT consecutive sectors starting at SECTOR, if
+   they are all free.  RESERVED is as for free_map_allocate().
+   Returns true if successful, false if any of the sectors is in
+   use or if the journal had no room to log the change. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt, bool reserved)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (may_allocate (cnt, reserved)
+      && sector + cnt <= bitmap_size (free_map)
+      && bitmap_none (free_map, sector, cnt)
+      && bitmap_none (released, sector, cnt))
+    {
+      success = set_bits (sector, cnt, true);
+      if (success)
+        count_allocated (cnt, reserved);
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.
+   Returns true if successful, false if the journal had no room to
+   log the change, in which case the sectors stay in use.
+   Releasing sectors allocated earlier in the same transaction
+   always succeeds. */
+bool
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  bool success;
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  success = set_bits (sector, cnt, false);
+  if (success)
+    bitmap_set_multiple (released, sector, cnt, true);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Sets aside CNT free sectors, so that allocations not drawing on
+   them cannot use them up.  Nothing is marked in use: the
+   sectors are taken later, wherever they are free, by allocations
+   with RESERVED true, and any not taken must be handed back with
+   free_map_unreserve().
+   Returns true if successful, false if fewer than CNT sectors are
+   free and not already set aside. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = unused_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Hands back CNT sectors set aside by free_map_reserve() that
+   were not allocated. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released since the last call available for
+   allocation again.  Called by the journal after each commit. */
+void
+free_map_commit (void)
+{
+  lock_acquire (&free_map_lock);
+  unused_cnt += bitmap_count (released, 0, bitmap_size (released), true);
+  bitmap_set_all (released, false);
+  lock_release (&free_map_lock);
+}
+
+/* Returns a copy of the free map, which the caller must destroy
+   with bitmap_destroy(), or a null pointer if memory is short. */
+struct bitmap *
+free_map_snapshot (void)
+{
+  struct bitmap *copy = bitmap_create (bitmap_size (free_map));
+  size_t i;
+
+  if (copy != NULL)
+    {
+      lock_acquire (&free_map_lock);
+      for (i = 0; i < bitmap_size (free_map); i++)
+        bitmap_set (copy, i, bitmap_test (free_map, i));
+      lock_release (&free_map_lock);
+    }
+  return copy;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +233,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  unused_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -68,18 +244,35 @@ free_map_close (void)
 }
 
 /* Creates a new free map file on disk and writes the free map to
-   it. */
+   it.  Must not be called within a transaction: it makes its own,
+   writing one sector of the file in each, so that none outgrows
+   the journal however large the device. */
 void
 free_map_create (void) 
 {
+  size_t size = bitmap_size (free_map);
+  size_t bits = BLOCK_SECTOR_SIZE * 8;
+  size_t i;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  journal_begin ();
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), true))
     PANIC ("free map creation failed");
+  journal_end ();
 
   /* Write bitmap to file. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
-    PANIC ("can't write free map");
+  for (i = 0; i < size; i += bits)
+    {
+      bool success;
+
+      journal_begin ();
+      success = bitmap_write_part (free_map, free_map_file, i,
+                                   size - i < bits ? size - i : bits);
+      journal_end ();
+      if (!success)
+        PANIC ("can't write free map");
+    }
 }
@@ -5,13 +5,21 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+struct bitmap;
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
 
-bool free_map_allocate (size_t, block_sector_t *);
-void free_map_release (block_sector_t, size_t);
+bool free_map_allocate (size_t, block_sector_t *, bool reserved);
+bool free_map_allocate_at (block_sector_t, size_t, bool reserved);
+bool free_map_release (block_sector_t, size_t);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+void free_map_commit (void);
+
+struct bitmap *free_map_snapshot (void);
 
 #endif /* filesys/free-map.h */
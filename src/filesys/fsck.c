@@ -0,0 +1,283 @@
+#include "filesys/fsck.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+
+/* File system consistency checker.
+
+   Builds its own map of the sectors in use by walking the
+   journal, the free map and root directory inodes and every file
+   in the root directory, then compares it against the free map.
+   Along the way it looks for:
+
+     - directory entries with a bad name, or whose inode is out of
+       range, already in use or not a well-formed inode;
+     - entries that a lookup of their name would not find;
+     - sectors that belong to more than one file (cross-linked);
+     - sectors in use that the free map says are free (lost);
+     - sectors the free map says are in use that belong to no
+       file (leaked).
+
+   When repairing, bad entries are erased, unreachable ones are
+   made reachable again and the free map is made to match the
+   sectors in use, so the sectors of an erased file are freed.
+   Cross-linked sectors are only reported: there is no telling
+   which of the files they belong to.
+
+   It also prints the layout of each file and of the free space,
+   to show how fragmented the file system has become.  It should
+   be run while nothing else uses the file system. */
+
+/* State of a check. */
+struct fsck
+  {
+    struct bitmap *used;        /* Sectors found in use so far. */
+    bool repair;                /* Repair problems? */
+    size_t problem_cnt;         /* Number of problems found. */
+    const char *name;           /* File being checked. */
+    size_t sector_cnt;          /* Its data sectors. */
+    size_t extent_cnt;          /* Its extents. */
+
+    /* Totals over all files. */
+    size_t file_cnt;            /* Files. */
+    size_t fragmented_cnt;      /* Files in more than one extent. */
+    size_t sector_total;        /* Data sectors. */
+    size_t extent_total;        /* Extents. */
+  };
+
+static void problem (struct fsck *, const char *, ...) PRINTF_FORMAT (2, 3);
+
+/* Reports a problem with the file system. */
+static void
+problem (struct fsck *f, const char *format, ...)
+{
+  va_list args;
+
+  f->problem_cnt++;
+  printf ("fsck: ");
+  va_start (args, format);
+  vprintf (format, args);
+  va_end (args);
+  printf ("\n");
+}
+
+/* Marks the CNT sectors starting at START as in use by the file
+   being checked, reporting any that are already in use.  Only
+   DATA sectors count toward the file's layout. */
+static void
+claim_extent (block_sector_t start, size_t cnt, bool data, void *f_)
+{
+  struct fsck *f = f_;
+  size_t cross = bitmap_count (f->used, start, cnt, true);
+
+  if (cross > 0)
+    problem (f, "%s: %zu of sectors %"PRDSNu"...%"PRDSNu" cross-linked",
+             f->name, cross, start, (block_sector_t) (start + cnt - 1));
+  bitmap_set_multiple (f->used, start, cnt, true);
+  if (data)
+    {
+      f->sector_cnt += cnt;
+      f->extent_cnt++;
+    }
+}
+
+/* Checks the inode of the file NAME, in SECTOR, and claims its
+   sectors.  Returns true if it is a well-formed inode that is not
+   also used by another file, false otherwise. */
+static bool
+check_inode (struct fsck *f, const char *name, block_sector_t sector,
+             off_t *length)
+{
+  if (sector >= bitmap_size (f->used))
+    {
+      problem (f, "%s: inode sector %"PRDSNu" out of range", name, sector);
+      return false;
+    }
+  if (bitmap_test (f->used, sector))
+    {
+      problem (f, "%s: inode sector %"PRDSNu" already in use", name, sector);
+      return false;
+    }
+
+  f->name = name;
+  f->sector_cnt = f->extent_cnt = 0;
+  bitmap_mark (f->used, sector);
+  if (!inode_check (sector, length, claim_extent, f))
+    {
+      problem (f, "%s: bad inode in sector %"PRDSNu, name, sector);
+      bitmap_reset (f->used, sector);
+      return false;
+    }
+  return true;
+}
+
+/* Checks root directory entry NAME for the inode in SECTOR,
+   which REACHABLE tells whether a lookup would find, and prints
+   the layout of its file.  Returns false if the entry should be
+   erased. */
+static bool
+check_entry (const char *name, block_sector_t sector, bool reachable,
+             void *f_)
+{
+  struct fsck *f = f_;
+  off_t length;
+
+  if (name == NULL)
+    {
+      problem (f, "entry for inode %"PRDSNu" has a bad name", sector);
+      return false;
+    }
+  if (!check_inode (f, name, sector, &length))
+    return false;
+  if (!reachable)
+    problem (f, "%s: lookup does not find entry", name);
+
+  printf ("%-14s %8"PROTd" bytes %6zu sectors %4zu extents",
+          name, length, f->sector_cnt, f->extent_cnt);
+  if (f->extent_cnt > 0)
+    printf (", %zu per extent", f->sector_cnt / f->extent_cnt);
+  printf ("\n");
+
+  f->file_cnt++;
+  f->sector_total += f->sector_cnt;
+  f->extent_total += f->extent_cnt;
+  if (f->extent_cnt > 1)
+    f->fragmented_cnt++;
+  return true;
+}
+
+/* Compares MAP, a copy of the free map, against the sectors found
+   in use, and brings the free map in line if repairing. */
+static void
+check_free_map (struct fsck *f, const struct bitmap *map)
+{
+  size_t size = bitmap_size (map);
+  size_t lost = 0, leaked = 0;
+  size_t sector, run;
+
+  for (sector = 0; sector < size; sector += run)
+    {
+      bool used = bitmap_test (f->used, sector);
+
+      /* Find the run of sectors, starting at SECTOR, that are
+         all wrong in the same way, but no longer than one sector
+         of the free map holds, so that fixing it fits in a
+         transaction. */
+      run = 1;
+      if (bitmap_test (map, sector) == used)
+        continue;
+      while (sector + run < size && run < BLOCK_SECTOR_SIZE * 8
+             && bitmap_test (f->used, sector + run) == used
+             && bitmap_test (map, sector + run) != used)
+        run++;
+
+      if (used)
+        lost += run;
+      else
+        leaked += run;
+      if (f->repair)
+        {
+          journal_begin ();
+          if (!used)
+            free_map_release (sector, run);
+          else if (!free_map_allocate_at (sector, run, false))
+            printf ("fsck: could not mark sectors %zu...%zu in use\n",
+                    sector, sector + run - 1);
+          journal_end ();
+        }
+    }
+
+  if (lost > 0)
+    problem (f, "%zu sectors in use are marked free", lost);
+  if (leaked > 0)
+    problem (f, "%zu sectors marked in use belong to no file", leaked);
+}
+
+/* Prints how the sectors not in USED are spread out. */
+static void
+print_free_space (const struct bitmap *used)
+{
+  size_t size = bitmap_size (used);
+  size_t free_cnt = 0, run_cnt = 0, largest = 0;
+  size_t sector = 0;
+
+  while (sector < size)
+    {
+      size_t start = bitmap_scan (used, sector, 1, false);
+      size_t end;
+
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (used, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      free_cnt += end - start;
+      run_cnt++;
+      if (end - start > largest)
+        largest = end - start;
+      sector = end;
+    }
+  printf ("fsck: %zu free sectors in %zu runs, largest %zu\n",
+          free_cnt, run_cnt, largest);
+}
+
+/* Checks the file system, printing each problem found and the
+   layout of each file.  If REPAIR is true, also repairs what it
+   can.  Returns the number of problems found. */
+size_t
+fsck (bool repair)
+{
+  struct fsck f;
+  struct bitmap *map;
+  struct dir *dir;
+  off_t length;
+
+  printf ("Checking file system%s...\n", repair ? " and repairing it" : "");
+  filesys_sync ();
+
+  f.used = bitmap_create (block_size (fs_device));
+  if (f.used == NULL)
+    PANIC ("fsck: out of memory");
+  f.repair = repair;
+  f.problem_cnt = 0;
+  f.file_cnt = f.fragmented_cnt = f.sector_total = f.extent_total = 0;
+  bitmap_set_multiple (f.used, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+  /* Without these two there is nothing to check or repair. */
+  if (!check_inode (&f, "[free map]", FREE_MAP_SECTOR, &length)
+      || !check_inode (&f, "[root dir]", ROOT_DIR_SECTOR, &length))
+    {
+      printf ("fsck: cannot continue\n");
+      bitmap_destroy (f.used);
+      return f.problem_cnt;
+    }
+
+  /* Files. */
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+  dir_check (dir, repair, check_entry, &f);
+  dir_close (dir);
+  printf ("fsck: %zu files, %zu sectors in %zu extents, %zu fragmented\n",
+          f.file_cnt, f.sector_total, f.extent_total, f.fragmented_cnt);
+
+  /* Free map. */
+  map = free_map_snapshot ();
+  if (map == NULL)
+    PANIC ("fsck: out of memory");
+  check_free_map (&f, map);
+  print_free_space (repair ? f.used : map);
+  bitmap_destroy (map);
+  bitmap_destroy (f.used);
+
+  if (repair)
+    filesys_sync ();
+  printf ("fsck: %zu problems found\n", f.problem_cnt);
+  return f.problem_cnt;
+}
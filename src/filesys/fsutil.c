@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,8 +8,12 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/fsck.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* List files in the root directory. */
@@ -27,6 +32,62 @@ fsutil_ls (char **argv UNUSED)
   printf ("End of listing.\n");
 }
 
+/* Reports how the files in the root directory are laid out on
+   disk: how many sectors each one has and into how many
+   separate runs, or extents, they are broken up. */
+void
+fsutil_frag (char **argv UNUSED) 
+{
+  struct dir *dir;
+  char name[NAME_MAX + 1];
+  size_t file_cnt = 0, fragmented_cnt = 0;
+  size_t sector_total = 0, extent_total = 0;
+
+  printf ("Layout of files in the root directory:\n");
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("root dir open failed");
+  while (dir_readdir (dir, name))
+    {
+      struct file *file = filesys_open (name);
+      struct inode *inode;
+      size_t sectors, extents;
+
+      if (file == NULL)
+        continue;
+      inode = file_get_inode (file);
+      sectors = inode_sector_cnt (inode);
+      extents = inode_extent_cnt (inode);
+      printf ("%-14s %8d bytes %6zu sectors %4zu extents\n",
+              name, file_length (file), sectors, extents);
+
+      file_cnt++;
+      sector_total += sectors;
+      extent_total += extents;
+      if (extents > 1)
+        fragmented_cnt++;
+      file_close (file);
+    }
+  dir_close (dir);
+  printf ("%zu files, %zu sectors in %zu extents, %zu fragmented\n",
+          file_cnt, sector_total, extent_total, fragmented_cnt);
+}
+
+/* Checks the file system for problems and reports them, along
+   with the layout of every file. */
+void
+fsutil_fsck (char **argv UNUSED)
+{
+  fsck (false);
+}
+
+/* Checks the file system and repairs the problems it finds. */
+void
+fsutil_fsck_repair (char **argv UNUSED)
+{
+  fsck (true);
+}
+
 /* Prints the contents of file ARGV[1] to the system console as
    hex and ASCII. */
 void
@@ -66,6 +127,159 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Sectors moved to or from the scratch device at a time. */
+#define STREAM_SECTORS 64
+
+/* A double-buffered stream of consecutive sectors on the scratch
+   device.  A helper thread reads ahead into one buffer, or writes
+   behind from it, while the caller works on the other, so that
+   scratch device transfers overlap file system I/O.  Each buffer
+   is moved with a single multi-sector transfer. */
+struct stream
+  {
+    struct block *block;        /* Scratch device. */
+    bool writing;               /* Writing to BLOCK, or reading? */
+    block_sector_t sector;      /* Next sector the helper moves. */
+
+    uint8_t *buf[2];            /* Buffers. */
+    size_t cnt[2];              /* Sectors of data in each buffer. */
+    struct semaphore caller[2]; /* Up when a buffer is the caller's. */
+    struct semaphore helper[2]; /* Up when a buffer is the helper's. */
+    struct semaphore done;      /* Up when the helper has exited. */
+    bool stop;                  /* Tells the helper to exit. */
+
+    int cur;                    /* Buffer the caller uses next. */
+    bool held;                  /* Does the caller hold CUR? */
+    size_t pos;                 /* Sectors of CUR already handed out. */
+  };
+
+/* Body of a stream's helper thread.  Takes each buffer in turn
+   from the caller, fills it from the device or writes it out,
+   and hands it back. */
+static void
+stream_helper (void *s_)
+{
+  struct stream *s = s_;
+  int i;
+
+  for (i = 0; ; i ^= 1)
+    {
+      sema_down (&s->helper[i]);
+      if (s->stop)
+        break;
+      if (s->writing)
+        block_write_multiple (s->block, s->sector, s->cnt[i], s->buf[i]);
+      else
+        {
+          s->cnt[i] = block_size (s->block) - s->sector;
+          if (s->cnt[i] > STREAM_SECTORS)
+            s->cnt[i] = STREAM_SECTORS;
+          block_read_multiple (s->block, s->sector, s->cnt[i], s->buf[i]);
+        }
+      s->sector += s->cnt[i];
+      sema_up (&s->caller[i]);
+    }
+  sema_up (&s->done);
+}
+
+/* Starts stream S reading from, or if WRITING is true writing
+   to, BLOCK from SECTOR onward.  A reading stream starts reading
+   ahead at once. */
+static void
+stream_open (struct stream *s, struct block *block, block_sector_t sector,
+             bool writing)
+{
+  int i;
+
+  s->block = block;
+  s->writing = writing;
+  s->sector = sector;
+  for (i = 0; i < 2; i++)
+    {
+      s->buf[i] = malloc (STREAM_SECTORS * BLOCK_SECTOR_SIZE);
+      if (s->buf[i] == NULL)
+        PANIC ("couldn't allocate buffers");
+      s->cnt[i] = 0;
+      sema_init (&s->caller[i], writing);
+      sema_init (&s->helper[i], !writing);
+    }
+  sema_init (&s->done, 0);
+  s->stop = false;
+  s->cur = 0;
+  s->held = false;
+  s->pos = 0;
+  if (thread_create ("stream", PRI_DEFAULT, stream_helper, s) == TID_ERROR)
+    PANIC ("couldn't start stream thread");
+}
+
+/* Gives the caller's current buffer in S to the helper, to be
+   refilled or written out. */
+static void
+stream_pass (struct stream *s)
+{
+  if (s->writing)
+    s->cnt[s->cur] = s->pos;
+  s->held = false;
+  sema_up (&s->helper[s->cur]);
+  s->cur ^= 1;
+}
+
+/* Returns the next 1 to MAX consecutive sectors of S, storing how
+   many in *CNT.  For a reading stream they hold the data read;
+   the caller must be done with them before its next call.  For a
+   writing stream the caller must fill them in, and they are
+   written out later.  Returns a null pointer if a reading stream
+   has reached the end of its device. */
+static void *
+stream_next (struct stream *s, size_t max, size_t *cnt)
+{
+  size_t avail;
+  void *p;
+
+  ASSERT (max > 0);
+
+  for (;;)
+    {
+      if (!s->held)
+        {
+          sema_down (&s->caller[s->cur]);
+          s->held = true;
+          s->pos = 0;
+        }
+      avail = (s->writing ? STREAM_SECTORS : s->cnt[s->cur]) - s->pos;
+      if (avail > 0)
+        break;
+      else if (!s->writing && s->cnt[s->cur] == 0)
+        return NULL;
+      stream_pass (s);
+    }
+
+  *cnt = avail < max ? avail : max;
+  p = s->buf[s->cur] + s->pos * BLOCK_SECTOR_SIZE;
+  s->pos += *cnt;
+  return p;
+}
+
+/* Finishes stream S, waiting until everything handed out by a
+   writing stream has been written, and stops its helper. */
+static void
+stream_close (struct stream *s)
+{
+  int i;
+
+  if (s->writing && s->held && s->pos > 0)
+    stream_pass (s);
+  for (i = 0; i < 2; i++)
+    if (!s->held || i != s->cur)
+      sema_down (&s->caller[i]);
+  s->stop = true;
+  sema_up (&s->helper[0]);
+  sema_up (&s->helper[1]);
+  sema_down (&s->done);
+  for (i = 0; i < 2; i++)
+    free (s->buf[i]);
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
@@ -74,12 +288,12 @@ fsutil_extract (char **argv UNUSED)
   static block_sector_t sector = 0;
 
   struct block *src;
-  void *header, *data;
+  struct stream stream;
+  void *header;
 
-  /* Allocate buffers. */
+  /* Allocate buffer. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
-  if (header == NULL || data == NULL)
+  if (header == NULL)
     PANIC ("couldn't allocate buffers");
 
   /* Open source block device. */
@@ -90,15 +304,24 @@ fsutil_extract (char **argv UNUSED)
   printf ("Extracting ustar archive from scratch device "
           "into file system...\n");
 
+  stream_open (&stream, src, sector, false);
   for (;;)
     {
       const char *file_name;
       const char *error;
       enum ustar_type type;
+      size_t cnt;
+      void *p;
       int size;
 
-      /* Read and parse ustar header. */
-      block_read (src, sector++, header);
+      /* Read and parse ustar header.  The header is copied out of
+         the stream because its name is still needed once the
+         stream has moved on. */
+      p = stream_next (&stream, 1, &cnt);
+      if (p == NULL)
+        PANIC ("ustar archive runs past end of scratch device");
+      memcpy (header, p, BLOCK_SECTOR_SIZE);
+      sector++;
       error = ustar_parse_header (header, &file_name, &type, &size);
       if (error != NULL)
         PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector - 1, error);
@@ -123,16 +346,24 @@ fsutil_extract (char **argv UNUSED)
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, as many sectors at a time as the stream has
+             ready. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
-              if (file_write (dst, data, chunk_size) != chunk_size)
+              int chunk_size;
+
+              p = stream_next (&stream,
+                               DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE), &cnt);
+              if (p == NULL)
+                PANIC ("%s: archive runs past end of scratch device",
+                       file_name);
+              chunk_size = (size > (int) (cnt * BLOCK_SECTOR_SIZE)
+                            ? (int) (cnt * BLOCK_SECTOR_SIZE)
+                            : size);
+              if (file_write (dst, p, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
+              sector += cnt;
               size -= chunk_size;
             }
 
@@ -140,6 +371,7 @@ fsutil_extract (char **argv UNUSED)
           file_close (dst);
         }
     }
+  stream_close (&stream);
 
   /* Erase the ustar header from the start of the block device,
      so that the extraction operation is idempotent.  We erase
@@ -150,7 +382,6 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
   free (header);
 }
 
@@ -166,57 +397,64 @@ void
 fsutil_append (char **argv)
 {
   static block_sector_t sector = 0;
+  static uint8_t zeros[2 * BLOCK_SECTOR_SIZE];
 
   const char *file_name = argv[1];
-  void *buffer;
+  struct stream stream;
   struct file *src;
   struct block *dst;
+  size_t cnt;
   off_t size;
+  void *p;
 
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
-  /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
-  if (buffer == NULL)
-    PANIC ("couldn't allocate buffer");
-
   /* Open source file. */
   src = filesys_open (file_name);
   if (src == NULL)
     PANIC ("%s: open failed", file_name);
   size = file_length (src);
 
-  /* Open target block device. */
+  /* Open target block device.  The header, the data and the
+     end-of-archive marker must all fit. */
   dst = block_get_role (BLOCK_SCRATCH);
   if (dst == NULL)
     PANIC ("couldn't open scratch device");
+  if (sector + 1 + DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE) + 2
+      > block_size (dst))
+    PANIC ("%s: out of space on scratch device", file_name);
   
   /* Write ustar header to first sector. */
-  if (!ustar_make_header (file_name, USTAR_REGULAR, size, buffer))
+  stream_open (&stream, dst, sector, true);
+  p = stream_next (&stream, 1, &cnt);
+  if (!ustar_make_header (file_name, USTAR_REGULAR, size, p))
     PANIC ("%s: name too long for ustar format", file_name);
-  block_write (dst, sector++, buffer);
+  sector++;
 
-  /* Do copy. */
+  /* Do copy, reading as many sectors at a time as the stream has
+     room for. */
   while (size > 0) 
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
-        PANIC ("%s: out of space on scratch device", file_name);
-      if (file_read (src, buffer, chunk_size) != chunk_size)
+      off_t chunk_size;
+
+      p = stream_next (&stream, DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE), &cnt);
+      chunk_size = (size > (off_t) (cnt * BLOCK_SECTOR_SIZE)
+                    ? (off_t) (cnt * BLOCK_SECTOR_SIZE)
+                    : size);
+      if (file_read (src, p, chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
+      memset ((uint8_t *) p + chunk_size, 0,
+              cnt * BLOCK_SECTOR_SIZE - chunk_size);
+      sector += cnt;
       size -= chunk_size;
     }
+  stream_close (&stream);
 
   /* Write ustar end-of-archive marker, which is two consecutive
      sectors full of zeros.  Don't advance our position past
      them, though, in case we have more files to append. */
-  memset (buffer, 0, BLOCK_SECTOR_SIZE);
-  block_write (dst, sector, buffer);
-  block_write (dst, sector, buffer + 1);
+  block_write_multiple (dst, sector, 2, zeros);
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
 }
@@ -1,23 +1,92 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Inode flags. */
+#define INODE_METADATA 0x1              /* Contents go through journal. */
+#define INODE_INLINE 0x2                /* Data is in the inode itself. */
+
+/* A run of consecutive data sectors. */
+struct inode_extent
+  {
+    uint32_t ofs;                       /* First sector's index in file. */
+    block_sector_t start;               /* First sector. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
+/* Number of extent sectors a file may have. */
+#define INODE_EXTENT_SECTORS 4
+
+/* Largest file whose data is kept in its inode sector. */
+#define INODE_INLINE_MAX (BLOCK_SECTOR_SIZE - 5 * sizeof (uint32_t) \
+                          - INODE_EXTENT_SECTORS * sizeof (block_sector_t))
+
+/* Number of extents kept in the inode sector itself. */
+#define INODE_EXTENTS (INODE_INLINE_MAX / sizeof (struct inode_extent))
+
+/* Number of extents in each extent sector. */
+#define EXTENT_SECTOR_EXTENTS \
+  (BLOCK_SECTOR_SIZE / sizeof (struct inode_extent))
+
+/* Maximum number of extents in a file. */
+#define INODE_MAX_EXTENTS \
+  (INODE_EXTENTS + INODE_EXTENT_SECTORS * EXTENT_SECTOR_EXTENTS)
+
+/* Number of sectors' worth of written data buffered in memory
+   before it is given sectors on disk. */
+#define INODE_DELAY_SECTORS 16
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The data sectors of a file are described by a list of extents,
+   sorted by OFS.  The first INODE_EXTENTS are kept in the inode
+   and the rest, EXTENT_SECTOR_EXTENTS to a sector, in extent
+   sectors, which are allocated as the list grows.  Parts of the
+   file that no extent covers are holes: they read as zeros and
+   get sectors only when first written, so creating a large file
+   costs no data writes.  A small file instead keeps its data in
+   INLINE_DATA, so that it can be read without any disk access
+   beyond reading its inode.  Once it grows past INODE_INLINE_MAX
+   bytes its data moves out to data sectors for good.
+
+   A file may have sectors past its length, if space was reserved
+   with inode_allocate().  Data that was still buffered when the
+   system went down is lost and reads as a hole. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    unsigned flags;                     /* INODE_* flags. */
+    uint32_t sector_cnt;                /* Number of data sectors. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    block_sector_t extent_sectors[INODE_EXTENT_SECTORS]; /* Or 0. */
+    union
+      {
+        struct inode_extent extents[INODE_EXTENTS];  /* Data sectors. */
+        uint8_t inline_data[INODE_INLINE_MAX];  /* If INODE_INLINE. */
+      }
+    u;
+  };
+
+/* An extent sector. */
+struct extent_sector
+  {
+    struct inode_extent extents[EXTENT_SECTOR_EXTENTS];
+    uint8_t unused[BLOCK_SECTOR_SIZE
+                   - EXTENT_SECTOR_EXTENTS * sizeof (struct inode_extent)];
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,79 +97,477 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   Members marked [T] are protected by inode_table_lock.  Data
+   reads and writes take RWLOCK, shared and exclusive
+   respectively, so readers of one file run concurrently with
+   each other and with any access to a different file.  While
+   LOADING, the opener that is reading DATA and the extent sectors
+   from disk holds RWLOCK exclusively.  If memory for the extent
+   sectors runs out, the inode is left BROKEN and every open of it
+   fails until it leaves the table. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* [T] Element in open_inodes. */
+    struct list_elem lru_elem;          /* [T] Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
-    bool removed;                       /* True if deleted, false otherwise. */
+    int open_cnt;                       /* [T] Number of openers. */
+    bool removed;                       /* [T] True if deleted. */
+    bool loading;                       /* DATA not yet read from disk? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Guards data access. */
+    struct rwlock dir_lock;             /* For directory operations. */
+    uint8_t *delayed;                   /* Written data not yet on disk. */
+    size_t delay_sector;                /* First file sector buffered. */
+    size_t delay_max;                   /* Sectors the buffer may hold. */
+    size_t delay_cnt;                   /* Sectors the buffer holds. */
+    size_t delay_reserved;              /* Free sectors set aside for it. */
+    int64_t delay_since;                /* Timer tick buffer was made. */
     struct inode_disk data;             /* Inode content. */
+    struct extent_sector *more[INODE_EXTENT_SECTORS]; /* Extent sectors. */
+    size_t extents_changed;             /* First extent not on disk. */
+    bool broken;                        /* Extent sectors unreadable? */
   };
 
+/* Returns extent I of INODE, which must be less than
+   INODE_MAX_EXTENTS and, if it is past those in the inode sector,
+   in an extent sector that INODE has in memory. */
+static struct inode_extent *
+extent (struct inode *inode, size_t i)
+{
+  if (i < INODE_EXTENTS)
+    return &inode->data.u.extents[i];
+  i -= INODE_EXTENTS;
+  ASSERT (inode->more[i / EXTENT_SECTOR_EXTENTS] != NULL);
+  return &inode->more[i / EXTENT_SECTOR_EXTENTS]->extents[i % EXTENT_SECTOR_EXTENTS];
+}
+
+/* Returns the number of extent sectors that the first CNT
+   extents of a file take. */
+static size_t
+extent_sector_cnt (size_t cnt)
+{
+  return (cnt > INODE_EXTENTS
+          ? DIV_ROUND_UP (cnt - INODE_EXTENTS, EXTENT_SECTOR_EXTENTS) : 0);
+}
+
+/* Returns the index of the first extent of INODE that starts
+   after file sector IDX, or INODE's extent count if there is
+   none. */
+static size_t
+next_extent (struct inode *inode, size_t idx)
+{
+  size_t lo = 0, hi = inode->data.extent_cnt;
+
+  /* Extents are sorted by OFS, so binary search. */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (extent (inode, mid)->ofs <= idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns -1 if POS is in a hole. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  size_t i;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (inode->data.flags & INODE_INLINE)
     return -1;
+  i = next_extent (inode, idx);
+  if (i > 0)
+    {
+      const struct inode_extent *e = extent (inode, i - 1);
+      if (idx < e->ofs + e->cnt)
+        return e->start + (idx - e->ofs);
+    }
+  return -1;
+}
+
+/* Returns the number of sectors from file sector IDX, which must
+   be in a hole, to the end of the hole, or SIZE_MAX if the hole
+   runs to the end of INODE. */
+static size_t
+hole_size (struct inode *inode, size_t idx)
+{
+  size_t i = next_extent (inode, idx);
+  return i < inode->data.extent_cnt ? extent (inode, i)->ofs - idx : SIZE_MAX;
+}
+
+/* Makes sure that INODE has room for one more extent, allocating
+   an extent sector for it if need be.  If RESERVED is nonnull, the
+   sector comes out of the *RESERVED sectors set aside for INODE.
+   The extent sector that will hold the new extent is claimed, as
+   by claim_inode().
+   Returns true if successful, false if INODE has
+   INODE_MAX_EXTENTS already, if memory or disk allocation fails,
+   or if the journal refuses a write. */
+static bool
+extent_room (struct inode *inode, size_t *reserved)
+{
+  struct inode_disk *d = &inode->data;
+  size_t k;
+
+  if (d->extent_cnt >= INODE_MAX_EXTENTS)
+    return false;
+  if (d->extent_cnt < INODE_EXTENTS
+      || (d->extent_cnt - INODE_EXTENTS) % EXTENT_SECTOR_EXTENTS != 0)
+    return true;
+
+  k = (d->extent_cnt - INODE_EXTENTS) / EXTENT_SECTOR_EXTENTS;
+  if (inode->more[k] == NULL)
+    {
+      inode->more[k] = calloc (1, sizeof *inode->more[k]);
+      if (inode->more[k] == NULL)
+        return false;
+    }
+  if (d->extent_sectors[k] == 0)
+    {
+      if (!free_map_allocate (1, &d->extent_sectors[k], reserved != NULL))
+        return false;
+      if (reserved != NULL)
+        --*reserved;
+    }
+  return journal_write (d->extent_sectors[k], inode->more[k]);
+}
+
+/* Claims INODE's sector, and those of its extent sectors that hold
+   extents FROM and up, for the running transaction, by logging
+   them as they are now.  Rewriting a sector already in the batch
+   always succeeds, so once a change is made only to claimed
+   sectors, write_inode() is sure to record it.  If FROM is
+   SIZE_MAX, only INODE's sector is claimed.
+   Returns true if successful, false if the journal refuses a
+   write. */
+static bool
+claim_inode (struct inode *inode, size_t from)
+{
+  struct inode_disk *d = &inode->data;
+  size_t k;
+
+  if (!journal_write (inode->sector, d))
+    return false;
+  if (from == SIZE_MAX)
+    return true;
+  k = from < INODE_EXTENTS ? 0 : (from - INODE_EXTENTS) / EXTENT_SECTOR_EXTENTS;
+  for (; k < INODE_EXTENT_SECTORS; k++)
+    if (d->extent_sectors[k] != 0 && inode->more[k] != NULL
+        && !journal_write (d->extent_sectors[k], inode->more[k]))
+      return false;
+  return true;
+}
+
+/* Gives sectors IDX...IDX + CNT - 1 of INODE, which must all be
+   in a hole, newly allocated data sectors.  Sectors right after
+   those of the extent that ends at IDX are used if they are free,
+   otherwise the longest free runs available, of at most a free
+   map sector's worth each.  Each run that does not continue an
+   extent takes a new extent.
+   If RESERVED is nonnull, the sectors, and any extent sectors
+   needed to record them, come out of the *RESERVED sectors set
+   aside for INODE.
+   Each run is recorded only in sectors claimed first, so the
+   caller's write_inode() cannot be refused.
+   Returns the number of sectors allocated, starting from IDX,
+   which is less than CNT only if the disk is full, INODE has no
+   room for another extent, or the journal refuses a write. */
+static size_t
+allocate_sectors (struct inode *inode, size_t idx, size_t cnt,
+                  size_t *reserved)
+{
+  struct inode_disk *d = &inode->data;
+  size_t added = 0;
+
+  while (added < cnt)
+    {
+      size_t pos = next_extent (inode, idx);
+      struct inode_extent *prev = NULL;
+      size_t run = cnt - added;
+      block_sector_t start;
+
+      /* A run of at most a free map sector's worth is marked in
+         at most two of its sectors, so that after a restart it
+         always fits in the transaction's room. */
+      if (run > BLOCK_SECTOR_SIZE * 8)
+        run = BLOCK_SECTOR_SIZE * 8;
+      if (!claim_inode (inode, pos > 0 ? pos - 1 : 0))
+        break;
+      if (pos > 0 && extent (inode, pos - 1)->ofs + extent (inode, pos - 1)->cnt == idx)
+        prev = extent (inode, pos - 1);
+      if (prev == NULL
+          || !free_map_allocate_at (prev->start + prev->cnt, run,
+                                    reserved != NULL))
+        {
+          /* Make room first, so that no run is allocated that
+             cannot be recorded. */
+          if (!extent_room (inode, reserved))
+            break;
+          while (run > 0 && !free_map_allocate (run, &start, reserved != NULL))
+            run /= 2;
+          if (run == 0)
+            break;
+          if (prev == NULL || start != prev->start + prev->cnt)
+            {
+              size_t i;
+
+              for (i = d->extent_cnt; i > pos; i--)
+                *extent (inode, i) = *extent (inode, i - 1);
+              d->extent_cnt++;
+              prev = extent (inode, pos);
+              prev->ofs = idx;
+              prev->start = start;
+              prev->cnt = 0;
+              pos++;
+            }
+        }
+      if (pos - 1 < inode->extents_changed)
+        inode->extents_changed = pos - 1;
+      if (reserved != NULL)
+        *reserved -= run;
+      prev->cnt += run;
+      d->sector_cnt += run;
+      idx += run;
+      added += run;
+    }
+  return added;
+}
+
+/* Releases the CNT sectors starting at SECTOR, a free map
+   sector's worth at a time.  Whenever the running transaction
+   runs out of room in the journal, ends it and begins another,
+   unless it is nested, in which case the rest stay in use.
+   Releasing sectors allocated earlier in the same transaction
+   never needs that. */
+static void
+release_run (block_sector_t sector, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t run = cnt < BLOCK_SECTOR_SIZE * 8 ? cnt : BLOCK_SECTOR_SIZE * 8;
+
+      if (free_map_release (sector, run))
+        {
+          sector += run;
+          cnt -= run;
+        }
+      else if (journal_refused () && !journal_nested ())
+        {
+          journal_end ();
+          journal_begin ();
+        }
+      else
+        return;
+    }
+}
+
+/* Releases all the data sectors and extent sectors of INODE, in
+   as many transactions as it takes (see release_run()). */
+static void
+release_sectors (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  size_t i;
+
+  if (d->flags & INODE_INLINE)
+    return;
+  for (i = 0; i < d->extent_cnt; i++)
+    release_run (extent (inode, i)->start, extent (inode, i)->cnt);
+  for (i = 0; i < INODE_EXTENT_SECTORS; i++)
+    if (d->extent_sectors[i] != 0)
+      release_run (d->extent_sectors[i], 1);
+}
+
+/* Reads the extent sectors of INODE, whose DATA has just been
+   read, into memory.
+   Returns true if successful, false if memory is short. */
+static bool
+read_extents (struct inode *inode)
+{
+  size_t k;
+
+  if (inode->data.flags & INODE_INLINE)
+    return true;
+  for (k = 0; k < extent_sector_cnt (inode->data.extent_cnt); k++)
+    {
+      inode->more[k] = malloc (sizeof *inode->more[k]);
+      if (inode->more[k] == NULL)
+        return false;
+      journal_read (inode->data.extent_sectors[k], inode->more[k]);
+    }
+  return true;
+}
+
+/* Frees INODE's extent sectors in memory. */
+static void
+free_extents (struct inode *inode)
+{
+  size_t k;
+
+  for (k = 0; k < INODE_EXTENT_SECTORS; k++)
+    {
+      free (inode->more[k]);
+      inode->more[k] = NULL;
+    }
+}
+
+/* Writes INODE's DATA, and those of its extent sectors that have
+   changed since it was last written, through the journal.
+   Must be called within a journal transaction, in which the
+   sectors must have been claimed with claim_inode(). */
+static void
+write_inode (struct inode *inode)
+{
+  size_t cnt = extent_sector_cnt (inode->data.extent_cnt);
+  bool logged;
+  size_t k;
+
+  logged = journal_write (inode->sector, &inode->data);
+  if (inode->extents_changed < INODE_EXTENTS)
+    inode->extents_changed = INODE_EXTENTS;
+  for (k = (inode->extents_changed - INODE_EXTENTS) / EXTENT_SECTOR_EXTENTS;
+       k < cnt; k++)
+    logged &= journal_write (inode->data.extent_sectors[k], inode->more[k]);
+  inode->extents_changed = SIZE_MAX;
+  ASSERT (logged);
+}
+
+/* Reads data sector SECTOR of INODE into BUFFER. */
+static void
+read_sector (const struct inode *inode, block_sector_t sector, void *buffer)
+{
+  if (inode->data.flags & INODE_METADATA)
+    journal_read (sector, buffer);
+  else
+    block_read (fs_device, sector, buffer);
+}
+
+/* Writes BUFFER to data sector SECTOR of INODE.
+   Returns true if successful, false if the journal refuses to log
+   a metadata sector. */
+static bool
+write_sector (const struct inode *inode, block_sector_t sector,
+              const void *buffer)
+{
+  if (inode->data.flags & INODE_METADATA)
+    return journal_write (sector, buffer);
+  block_write (fs_device, sector, buffer);
+  return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Maximum number of closed inodes kept in memory. */
+#define CLOSED_INODE_MAX 16
+
+/* Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.
+
+   Besides the open inodes, the table holds up to
+   CLOSED_INODE_MAX inodes whose last opener has closed them.
+   These are kept on closed_inodes, least recently closed last,
+   so that reopening a recently used file does not have to read
+   its inode from disk again. */
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
+static struct lock inode_table_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static struct inode *inode_find (block_sector_t);
+static void inode_evict (struct inode *);
+static void inode_discard (struct inode *);
+static bool inode_delayed (const struct inode *, size_t idx);
+static bool inode_flush_delayed (struct inode *);
+static void delay_drop (struct inode *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  lock_init (&inode_table_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  If METADATA is true, the inode holds file system
+   metadata, such as a directory, and writes to it are journaled.
+   Its sectors are allocated and zeroed now, since metadata tends
+   to be written all over and would otherwise end up in many
+   small extents.  Otherwise the data is a hole, or, if LENGTH is
+   small enough, it is stored inline, and nothing but the inode
+   is written.
+   Must be called within a journal transaction.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory or disk allocation fails or if the
+   journal refuses a write. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool metadata)
 {
-  struct inode_disk *disk_inode = NULL;
+  struct inode *inode = NULL;
   bool success = false;
 
   ASSERT (length >= 0);
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  /* If these assertions fail, the inode structure or an extent
+     sector is not exactly one sector in size, and you should fix
+     that. */
+  ASSERT (sizeof (struct inode_disk) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_sector) == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  /* The extent functions work on an in-memory inode, so build one
+     that nobody else can see. */
+  inode = calloc (1, sizeof *inode);
+  if (inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      struct inode_disk *disk_inode = &inode->data;
+      bool inline_data = !metadata && length <= (off_t) INODE_INLINE_MAX;
+      size_t sectors = metadata ? bytes_to_sectors (length) : 0;
+      struct inode *stale;
+      size_t i;
+
+      /* A closed inode cached for SECTOR no longer describes it. */
+      lock_acquire (&inode_table_lock);
+      stale = inode_find (sector);
+      if (stale != NULL)
+        {
+          ASSERT (stale->open_cnt == 0);
+          inode_evict (stale);
+        }
+      lock_release (&inode_table_lock);
+
+      inode->sector = sector;
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->flags = (metadata ? INODE_METADATA : 0)
+                          | (inline_data ? INODE_INLINE : 0);
+      if (claim_inode (inode, SIZE_MAX)
+          && allocate_sectors (inode, 0, sectors, NULL) == sectors) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          static char zeros[BLOCK_SECTOR_SIZE];
+
+          write_inode (inode);
+          for (i = 0; i < sectors; i++) 
+            block_write (fs_device,
+                         byte_to_sector (inode, i * BLOCK_SECTOR_SIZE),
+                         zeros);
           success = true; 
         } 
-      free (disk_inode);
+      else
+        release_sectors (inode);
+      free_extents (inode);
+      free (inode);
     }
   return success;
 }
@@ -111,33 +578,73 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open, or was closed
+     recently enough to still be cached. */
+  lock_acquire (&inode_table_lock);
+  inode = inode_find (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt == 0)
+        {
+          list_remove (&inode->lru_elem);
+          closed_cnt--;
+        }
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+
+      /* Wait for another opener to finish reading it. */
+      if (inode->loading)
         {
-          inode_reopen (inode);
-          return inode; 
+          rwlock_acquire_read (&inode->rwlock);
+          rwlock_release_read (&inode->rwlock);
         }
+      if (inode->broken)
+        {
+          inode_discard (inode);
+          return NULL;
+        }
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode goes into the table still loading, so
+     that the disk read below does not hold up opens and closes of
+     other inodes.  Anyone who opens it meanwhile waits for RWLOCK,
+     which is held until its data is valid. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  inode->delayed = NULL;
+  inode->delay_reserved = 0;
+  memset (inode->more, 0, sizeof inode->more);
+  inode->extents_changed = SIZE_MAX;
+  inode->broken = false;
+  rwlock_init (&inode->rwlock);
+  rwlock_init (&inode->dir_lock);
+  rwlock_acquire_write (&inode->rwlock);
+  hash_insert (&open_inodes, &inode->hash_elem);
+  lock_release (&inode_table_lock);
+
+  journal_read (inode->sector, &inode->data);
+  inode->broken = !read_extents (inode);
+  inode->loading = false;
+  rwlock_release_write (&inode->rwlock);
+  if (inode->broken)
+    {
+      inode_discard (inode);
+      return NULL;
+    }
   return inode;
 }
 
@@ -146,7 +653,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -167,22 +678,44 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* Give any buffered data its sectors before what may be the
+     last reference goes away. */
+  if (inode->delayed != NULL)
+    inode_flush_delayed (inode);
+
   /* Release resources if this was the last opener. */
+  lock_acquire (&inode_table_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          /* Deallocate blocks if removed.  Nobody can find the
+             inode once it is out of the table, so the free map
+             can be updated without holding the table lock.  A
+             large file may take several transactions; a crash
+             between them leaves the rest in use by no file, as
+             for a file removed while open, for fsck to find. */
+          hash_delete (&open_inodes, &inode->hash_elem);
+          lock_release (&inode_table_lock);
+          journal_begin ();
+          release_run (inode->sector, 1);
+          release_sectors (inode);
+          journal_end ();
+          delay_drop (inode);
+          free_extents (inode);
+          free (inode); 
+          return;
+        }
+      else
+        {
+          /* Keep it around in case it is reopened soon. */
+          list_push_front (&closed_inodes, &inode->lru_elem);
+          if (++closed_cnt > CLOSED_INODE_MAX)
+            inode_evict (list_entry (list_back (&closed_inodes),
+                                     struct inode, lru_elem));
         }
-
-      free (inode); 
     }
+  lock_release (&inode_table_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -191,7 +724,9 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode_table_lock);
   inode->removed = true;
+  lock_release (&inode_table_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -204,6 +739,17 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      off_t inode_left = inode_length (inode) - offset;
+      if (inode_left > 0)
+        {
+          bytes_read = size < inode_left ? size : inode_left;
+          memcpy (buffer, inode->data.u.inline_data + offset, bytes_read);
+        }
+      size = 0;
+    }
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -220,10 +766,22 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == (block_sector_t) -1)
+        {
+          /* Buffered, or a hole. */
+          size_t idx = offset / BLOCK_SECTOR_SIZE;
+          if (inode_delayed (inode, idx))
+            memcpy (buffer + bytes_read,
+                    inode->delayed + (offset - inode->delay_sector
+                                               * BLOCK_SECTOR_SIZE),
+                    chunk_size);
+          else
+            memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          read_sector (inode, sector_idx, buffer + bytes_read);
         }
       else 
         {
@@ -235,7 +793,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
               if (bounce == NULL)
                 break;
             }
-          block_read (fs_device, sector_idx, bounce);
+          read_sector (inode, sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
       
@@ -244,32 +802,333 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
+  rwlock_release_read (&inode->rwlock);
   free (bounce);
 
   return bytes_read;
 }
 
+/* Returns true if INODE's delay buffer covers file sector IDX.
+   The caller must hold INODE's lock. */
+static bool
+inode_delayed (const struct inode *inode, size_t idx)
+{
+  return (inode->delayed != NULL
+          && idx >= inode->delay_sector
+          && idx - inode->delay_sector < inode->delay_max);
+}
+
+/* Makes sure that INODE's delay buffer can hold its first CNT
+   sectors and still be flushed: that enough free sectors are set
+   aside for them and for any extent sectors they may need, if
+   each takes a new extent, and that INODE has room for that many
+   extents.
+   The caller must hold INODE's lock for writing.
+   Returns true if successful, false if the disk or INODE's
+   extents are full or memory allocation fails. */
+static bool
+delay_reserve (struct inode *inode, size_t cnt)
+{
+  struct inode_disk *d = &inode->data;
+  size_t need = cnt;
+  size_t k;
+
+  if (d->extent_cnt + cnt > INODE_MAX_EXTENTS)
+    return false;
+  for (k = 0; k < extent_sector_cnt (d->extent_cnt + cnt); k++)
+    {
+      if (inode->more[k] == NULL)
+        {
+          inode->more[k] = calloc (1, sizeof *inode->more[k]);
+          if (inode->more[k] == NULL)
+            return false;
+        }
+      if (d->extent_sectors[k] == 0)
+        need++;
+    }
+  if (need > inode->delay_reserved)
+    {
+      if (!free_map_reserve (need - inode->delay_reserved))
+        return false;
+      inode->delay_reserved = need;
+    }
+  return true;
+}
+
+/* Frees INODE's delay buffer, if any, and hands back the free
+   sectors still set aside for it. */
+static void
+delay_drop (struct inode *inode)
+{
+  free (inode->delayed);
+  inode->delayed = NULL;
+  free_map_unreserve (inode->delay_reserved);
+  inode->delay_reserved = 0;
+}
+
+/* Moves the data of inline INODE out of the inode, into a newly
+   allocated delay buffer.
+   The caller must hold INODE's lock for writing.
+   Returns true if successful, false if the disk is full or memory
+   allocation fails. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  uint8_t *buffer;
+
+  ASSERT (d->flags & INODE_INLINE);
+  ASSERT (inode->delayed == NULL);
+
+  buffer = calloc (INODE_DELAY_SECTORS, BLOCK_SECTOR_SIZE);
+  if (buffer == NULL)
+    return false;
+  d->sector_cnt = d->extent_cnt = 0;
+  if (!delay_reserve (inode, bytes_to_sectors (d->length)))
+    {
+      free (buffer);
+      return false;
+    }
+  memcpy (buffer, d->u.inline_data, d->length);
+  memset (&d->u, 0, sizeof d->u);
+  d->flags &= ~INODE_INLINE;
+  inode->delayed = buffer;
+  inode->delay_sector = 0;
+  inode->delay_max = INODE_DELAY_SECTORS;
+  inode->delay_cnt = bytes_to_sectors (d->length);
+  inode->delay_since = timer_ticks ();
+  return true;
+}
+
+/* Lets work on INODE that the journal refused to log go on in a
+   new transaction, if the running one was begun for that work
+   rather than around it.  INODE is written first, with its
+   length cut to LENGTH if longer, so that a crash between the two
+   transactions finds it as far as the work got.  INODE's lock,
+   which the caller must hold for writing, is released meanwhile.
+   Returns true if a new transaction was begun, false if the
+   caller must give up instead. */
+static bool
+inode_restart (struct inode *inode, off_t length)
+{
+  struct inode_disk *d = &inode->data;
+  off_t full = d->length;
+
+  if (!journal_refused () || journal_nested ())
+    return false;
+  if (length < full)
+    d->length = length;
+  write_inode (inode);
+  d->length = full;
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  journal_begin ();
+  rwlock_acquire_write (&inode->rwlock);
+  return claim_inode (inode, SIZE_MAX);
+}
+
+/* Gives the data in INODE's delay buffer sectors on disk, all
+   allocated in as few runs as possible, and writes it to them.
+   Then drops the delay buffer.
+   The caller must hold INODE's lock for writing and be within a
+   journal transaction, and must write the inode afterward.
+   Returns true if successful, false if sectors could not be
+   allocated despite those set aside or the journal refused a
+   write, in which case the buffer keeps whatever did not fit. */
+static bool
+inode_flush (struct inode *inode)
+{
+  size_t added, i;
+
+  ASSERT (inode->delayed != NULL);
+
+  added = allocate_sectors (inode, inode->delay_sector, inode->delay_cnt,
+                            &inode->delay_reserved);
+  for (i = 0; i < added; i++)
+    write_sector (inode,
+                  byte_to_sector (inode, ((inode->delay_sector + i)
+                                      * BLOCK_SECTOR_SIZE)),
+                  inode->delayed + i * BLOCK_SECTOR_SIZE);
+
+  if (added < inode->delay_cnt)
+    {
+      /* Keep what is still buffered at the front. */
+      size_t kept = INODE_DELAY_SECTORS - added;
+      memmove (inode->delayed, inode->delayed + added * BLOCK_SECTOR_SIZE,
+               kept * BLOCK_SECTOR_SIZE);
+      memset (inode->delayed + kept * BLOCK_SECTOR_SIZE, 0,
+              added * BLOCK_SECTOR_SIZE);
+      inode->delay_sector += added;
+      inode->delay_max -= added;
+      inode->delay_cnt -= added;
+      return false;
+    }
+  delay_drop (inode);
+  return true;
+}
+
+/* Makes INODE's delay buffer cover file sector IDX, which must be
+   in a hole, so that data written there can be buffered.
+
+   Data written to a hole is not given sectors right away.  It
+   goes into a delay buffer in memory instead, and only when a
+   write falls outside the buffer or the file is closed are
+   sectors allocated for all of the buffer at once.  A file
+   written in small pieces, perhaps alongside others, thus still
+   ends up in a few long runs of sectors.  Free sectors are set
+   aside as data enters the buffer, so a write that would not fit
+   on disk comes back short then rather than being lost later.
+
+   The caller must hold INODE's lock for writing and be within a
+   journal transaction, and must write the inode afterward.
+   Returns true if successful, false if memory or disk allocation
+   fails. */
+static bool
+inode_delay (struct inode *inode, size_t idx)
+{
+  size_t hole;
+
+  if (inode_delayed (inode, idx))
+    return true;
+  if (inode->delayed != NULL && !inode_flush (inode))
+    return false;
+
+  ASSERT (inode->delay_reserved == 0);
+  inode->delayed = calloc (INODE_DELAY_SECTORS, BLOCK_SECTOR_SIZE);
+  if (inode->delayed == NULL)
+    return false;
+  hole = hole_size (inode, idx);
+  inode->delay_sector = idx;
+  inode->delay_max = hole < INODE_DELAY_SECTORS ? hole : INODE_DELAY_SECTORS;
+  inode->delay_cnt = 0;
+  inode->delay_since = timer_ticks ();
+  return true;
+}
+
+/* Gives INODE's buffered data its sectors, in as many
+   transactions as it takes.  Sectors were set aside for the data
+   as it was buffered, so this fails only if the free map cannot
+   be written, and then the data that does not fit is lost.  It
+   reads back as a hole, or, if it ran to the end of the file,
+   INODE is cut short.  Within an enclosing transaction that has
+   no room left, the data stays buffered instead.
+   Returns true if successful or if nothing was buffered, false if
+   data was lost or is still buffered. */
+static bool
+inode_flush_delayed (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  bool success = true;
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->rwlock);
+  if (inode->delayed != NULL && !claim_inode (inode, SIZE_MAX))
+    success = false;
+  else if (inode->delayed != NULL)
+    {
+      while (!inode_flush (inode) && inode_restart (inode, d->length))
+        continue;
+      if (inode->delayed != NULL && journal_refused ())
+        success = false;
+      else if (inode->delayed != NULL)
+        {
+          success = false;
+          off_t lost = inode->delay_sector * BLOCK_SECTOR_SIZE;
+          off_t end = lost + inode->delay_cnt * BLOCK_SECTOR_SIZE;
+          if (d->length > lost && d->length <= end)
+            d->length = lost;
+          delay_drop (inode);
+        }
+      write_inode (inode);
+    }
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+  return success;
+}
+
+/* Returns true if writing SIZE bytes at OFFSET in INODE only
+   overwrites data sectors it already has, without touching the
+   inode itself. */
+static bool
+inode_mapped (struct inode *inode, off_t size, off_t offset)
+{
+  const struct inode_disk *d = &inode->data;
+  off_t pos;
+
+  if (size == 0)
+    return true;
+  if ((d->flags & INODE_INLINE) || offset + size > d->length)
+    return false;
+  for (pos = offset - offset % BLOCK_SECTOR_SIZE; pos < offset + size;
+       pos += BLOCK_SECTOR_SIZE)
+    if (byte_to_sector (inode, pos) == (block_sector_t) -1)
+      return false;
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if disk space runs out or an error occurs.
+   Writing past end of file extends the inode, and writing into a
+   hole gives it sectors.
+   Writes to a metadata inode must be made within a journal
+   transaction. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
+  struct inode_disk *d = &inode->data;
   off_t bytes_written = 0;
+  off_t old_length;
   uint8_t *bounce = NULL;
+  bool update_inode;
+
+  /* Writing inline data, past the end of the file, or into a hole
+     updates the inode, which is metadata, so it has to be done
+     in a journal transaction, which must be begun before taking
+     the lock.  A file never moves back inline and never loses
+     sectors, so once a write does not need the inode updated, it
+     never will. */
+  rwlock_acquire_write (&inode->rwlock);
+  update_inode = !inode_mapped (inode, size, offset);
+  if (update_inode)
+    {
+      rwlock_release_write (&inode->rwlock);
+      journal_begin ();
+      rwlock_acquire_write (&inode->rwlock);
+    }
+  if (inode->deny_write_cnt
+      || (update_inode && !claim_inode (inode, SIZE_MAX)))
+    {
+      rwlock_release_write (&inode->rwlock);
+      if (update_inode)
+        journal_end ();
+      return 0;
+    }
 
-  if (inode->deny_write_cnt)
-    return 0;
+  if (size > 0 && (d->flags & INODE_INLINE)
+      && offset + size > (off_t) INODE_INLINE_MAX
+      && !inode_uninline (inode))
+    size = 0;
+  old_length = d->length;
+  if (size > 0 && offset + size > d->length)
+    d->length = offset + size;
+  if (size > 0 && (d->flags & INODE_INLINE))
+    {
+      memcpy (d->u.inline_data + offset, buffer, size);
+      bytes_written = size;
+      offset += size;
+      size = 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
+      size_t idx = offset / BLOCK_SECTOR_SIZE;
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      bool fresh = false;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -281,30 +1140,78 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == (block_sector_t) -1
+          && !(d->flags & INODE_METADATA) && inode_delay (inode, idx))
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Into the delay buffer. */
+          size_t delay_idx = idx - inode->delay_sector;
+          if (delay_idx >= inode->delay_cnt
+              && !delay_reserve (inode, delay_idx + 1))
+            break;
+          memcpy (inode->delayed + delay_idx * BLOCK_SECTOR_SIZE + sector_ofs,
+                  buffer + bytes_written, chunk_size);
+          if (delay_idx >= inode->delay_cnt)
+            inode->delay_cnt = delay_idx + 1;
         }
-      else 
+      else
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          if (sector_idx == (block_sector_t) -1)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
+              /* Metadata, and data that cannot be buffered, goes
+                 to disk right away.  If the journal has no room
+                 left for the allocation, carry on in a new
+                 transaction. */
+              if (allocate_sectors (inode, idx, 1, NULL) == 0)
+                {
+                  if (update_inode
+                      && inode_restart (inode, offset > old_length
+                                               ? offset : old_length))
+                    continue;
+                  break;
+                }
+              sector_idx = byte_to_sector (inode, offset);
+              fresh = true;
+
+              /* A new metadata sector is zeroed in place, as in
+                 inode_create(), so that it holds no garbage even
+                 if the write below is refused. */
+              if (d->flags & INODE_METADATA)
+                {
+                  static char zeros[BLOCK_SECTOR_SIZE];
+                  block_write (fs_device, sector_idx, zeros);
+                }
+            }
+
+          if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+            {
+              /* Write full sector directly to disk. */
+              if (!write_sector (inode, sector_idx, buffer + bytes_written))
                 break;
             }
+          else 
+            {
+              /* We need a bounce buffer. */
+              if (bounce == NULL) 
+                {
+                  bounce = malloc (BLOCK_SECTOR_SIZE);
+                  if (bounce == NULL)
+                    break;
+                }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+              /* If the sector contains data before or after the
+                 chunk we're writing, then we need to read in the
+                 sector first.  Otherwise, or if the sector was a
+                 hole until now, we start with a sector of all
+                 zeros. */
+              if (!fresh && (sector_ofs > 0 || chunk_size < sector_left))
+                read_sector (inode, sector_idx, bounce);
+              else
+                memset (bounce, 0, BLOCK_SECTOR_SIZE);
+              memcpy (bounce + sector_ofs, buffer + bytes_written,
+                      chunk_size);
+              if (!write_sector (inode, sector_idx, bounce))
+                break;
+            }
         }
 
       /* Advance. */
@@ -312,6 +1219,19 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
+
+  /* Don't extend the file past what was actually written. */
+  if (d->length > old_length && d->length > offset)
+    d->length = offset > old_length ? offset : old_length;
+
+  if (update_inode)
+    {
+      write_inode (inode);
+      rwlock_release_write (&inode->rwlock);
+      journal_end ();
+    }
+  else
+    rwlock_release_write (&inode->rwlock);
   free (bounce);
 
   return bytes_written;
@@ -322,8 +1242,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +1254,156 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Gives every hole in the first END bytes of INODE sectors
+   filled with zeros.  The sectors are new, so they are zeroed in
+   place, as in inode_create().
+   The caller must hold INODE's lock for writing and be within a
+   journal transaction, and must write the inode afterward.
+   Returns true if successful, false if the disk is full or the
+   journal refuses a write. */
+static bool
+inode_fill (struct inode *inode, off_t end)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t cnt = bytes_to_sectors (end);
+  size_t idx = 0;
+
+  while (idx < cnt)
+    {
+      size_t hole, added, i;
+
+      if (byte_to_sector (inode, idx * BLOCK_SECTOR_SIZE) != (block_sector_t) -1)
+        {
+          idx++;
+          continue;
+        }
+      hole = hole_size (inode, idx);
+      if (hole > cnt - idx)
+        hole = cnt - idx;
+      added = allocate_sectors (inode, idx, hole, NULL);
+      for (i = 0; i < added; i++)
+        block_write (fs_device,
+                     byte_to_sector (inode, (idx + i) * BLOCK_SECTOR_SIZE),
+                     zeros);
+      if (added < hole)
+        return false;
+      idx += hole;
+    }
+  return true;
+}
+
+/* Reserves data sectors for the first LENGTH bytes of INODE, in
+   as few runs as possible, without changing its length.  Writes
+   within those bytes then need not allocate, and a file whose
+   final size is known ahead of time can be laid out contiguously
+   however it is written.
+   A large file may take several transactions, in which case a
+   crash can leave only some of them done.
+   Returns true if successful, false if LENGTH is negative or more
+   than the device holds, or if the disk is full. */
+bool
+inode_allocate (struct inode *inode, off_t length)
+{
+  struct inode_disk *d = &inode->data;
+  bool claimed;
+  bool success;
+
+  if (length < 0 || bytes_to_sectors (length) > block_size (fs_device))
+    return false;
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->rwlock);
+  claimed = success = claim_inode (inode, SIZE_MAX);
+  if (success && (d->flags & INODE_INLINE)
+      && length > (off_t) INODE_INLINE_MAX)
+    success = inode_uninline (inode);
+  if (success && !(d->flags & INODE_INLINE))
+    do
+      success = ((inode->delayed == NULL || inode_flush (inode))
+                 && inode_fill (inode, length));
+    while (!success && inode_restart (inode, d->length));
+  if (claimed)
+    write_inode (inode);
+  rwlock_release_write (&inode->rwlock);
+  journal_end ();
+
+  return success;
+}
+
+/* Writes INODE's buffered data to disk and commits all pending
+   metadata, so that everything written to INODE so far survives
+   a crash.
+   Returns true if successful, false if buffered data was lost
+   because the disk is full. */
+bool
+inode_sync (struct inode *inode)
+{
+  /* inode_flush_delayed() checks for buffered data under INODE's
+     lock. */
+  bool success = inode_flush_delayed (inode);
+  journal_flush ();
+  return success;
+}
+
+/* Gives sectors to the buffered data of every open inode whose
+   delay buffer was started before timer tick BEFORE. */
+void
+inode_flush_dirty (int64_t before)
+{
+  struct hash_iterator i;
+  struct inode **dirty;
+  size_t cnt = 0;
+  size_t j;
+
+  /* Flushing may wait for a journal commit, so it cannot be done
+     under inode_table_lock.  Collect the inodes first, keeping
+     each one open meanwhile. */
+  lock_acquire (&inode_table_lock);
+  dirty = malloc (hash_size (&open_inodes) * sizeof *dirty);
+  if (dirty != NULL)
+    {
+      hash_first (&i, &open_inodes);
+      while (hash_next (&i))
+        {
+          struct inode *inode = hash_entry (hash_cur (&i), struct inode,
+                                            hash_elem);
+          if (inode->open_cnt > 0 && inode->delayed != NULL
+              && inode->delay_since < before)
+            {
+              inode->open_cnt++;
+              dirty[cnt++] = inode;
+            }
+        }
+    }
+  lock_release (&inode_table_lock);
+
+  for (j = 0; j < cnt; j++)
+    {
+      inode_flush_delayed (dirty[j]);
+      inode_close (dirty[j]);
+    }
+  free (dirty);
+}
+
+/* Returns the number of data sectors allocated to INODE. */
+size_t
+inode_sector_cnt (const struct inode *inode)
+{
+  return inode->data.sector_cnt;
+}
+
+/* Returns the number of extents INODE's data sectors form. */
+size_t
+inode_extent_cnt (const struct inode *inode)
+{
+  return inode->data.extent_cnt;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +1412,180 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Checks that the inode in SECTOR is well formed: that it has
+   the right magic number, that its extent sectors lie on the
+   device, and that its extents are sorted, do not overlap within
+   the file, lie on the device and add up to its sector count.  If
+   it is, stores its length in *LENGTH, calls FUNC once for each
+   extent and once for each extent sector, passing it AUX, and
+   returns true.  Returns false without calling FUNC if it is not,
+   or if memory is short.  The inode is read as it is in memory if
+   it is open or cached, otherwise as the journal would read it
+   from disk, so the file system should be quiescent. */
+bool
+inode_check (block_sector_t sector, off_t *length,
+             inode_extent_func *func, void *aux)
+{
+  struct inode *c, *inode;
+  struct inode_disk *d;
+  bool ok = true;
+  size_t total = 0;
+  size_t i, k;
+
+  /* Work on a private copy, so that the extent functions apply. */
+  c = calloc (1, sizeof *c);
+  if (c == NULL)
+    return false;
+  d = &c->data;
+  lock_acquire (&inode_table_lock);
+  inode = inode_find (sector);
+  if (inode != NULL && !inode->loading && !inode->broken)
+    {
+      *d = inode->data;
+      for (k = 0; k < INODE_EXTENT_SECTORS; k++)
+        if (inode->more[k] != NULL)
+          {
+            c->more[k] = malloc (sizeof *c->more[k]);
+            if (c->more[k] == NULL)
+              ok = false;
+            else
+              *c->more[k] = *inode->more[k];
+          }
+    }
+  else
+    inode = NULL;
+  lock_release (&inode_table_lock);
+
+  /* An inode still being loaded has the same data as on disk. */
+  if (inode == NULL)
+    journal_read (sector, d);
+
+  if (!ok || d->magic != INODE_MAGIC || d->length < 0)
+    ok = false;
+  else if (d->flags & INODE_INLINE)
+    ok = (d->length <= (off_t) INODE_INLINE_MAX
+          && d->sector_cnt == 0 && !(d->flags & INODE_METADATA));
+  else if (d->extent_cnt > INODE_MAX_EXTENTS)
+    ok = false;
+  for (k = 0; ok && k < INODE_EXTENT_SECTORS; k++)
+    ok = ((d->extent_sectors[k] != 0 || k >= extent_sector_cnt (d->extent_cnt))
+          && d->extent_sectors[k] < block_size (fs_device)
+          && (d->extent_sectors[k] == 0 || !(d->flags & INODE_INLINE)));
+  if (ok && inode == NULL)
+    ok = read_extents (c);
+  if (ok && !(d->flags & INODE_INLINE))
+    for (i = 0; ok && i < d->extent_cnt; i++)
+      {
+        const struct inode_extent *e = extent (c, i);
+
+        ok = (e->cnt > 0
+              && e->start + e->cnt > e->start
+              && e->start + e->cnt <= block_size (fs_device)
+              && (i == 0 || e->ofs >= extent (c, i - 1)->ofs
+                                     + extent (c, i - 1)->cnt));
+        total += e->cnt;
+      }
+  if (ok && total != d->sector_cnt)
+    ok = false;
+
+  if (ok)
+    {
+      *length = d->length;
+      if (!(d->flags & INODE_INLINE))
+        for (i = 0; i < d->extent_cnt; i++)
+          func (extent (c, i)->start, extent (c, i)->cnt, true, aux);
+      for (k = 0; k < INODE_EXTENT_SECTORS; k++)
+        if (d->extent_sectors[k] != 0)
+          func (d->extent_sectors[k], 1, false, aux);
+    }
+  free_extents (c);
+  free (c);
+  return ok;
+}
+
+/* Locks directory INODE against concurrent directory
+   operations, which are made up of several inode reads and
+   writes that must appear atomic.  Lookups pass EXCLUSIVE as
+   false and may run alongside each other; anything that modifies
+   the directory passes true. */
+void
+inode_lock_dir (struct inode *inode, bool exclusive)
+{
+  if (exclusive)
+    rwlock_acquire_write (&inode->dir_lock);
+  else
+    rwlock_acquire_read (&inode->dir_lock);
+}
+
+/* Releases the lock taken on INODE by inode_lock_dir(), which must
+   be passed the same EXCLUSIVE. */
+void
+inode_unlock_dir (struct inode *inode, bool exclusive)
+{
+  if (exclusive)
+    rwlock_release_write (&inode->dir_lock);
+  else
+    rwlock_release_read (&inode->dir_lock);
+}
+
+/* Returns the in-memory inode for SECTOR, whether open or
+   closed, or a null pointer if there is none.
+   The caller must hold inode_table_lock. */
+static struct inode *
+inode_find (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct inode, hash_elem) : NULL;
+}
+
+/* Frees closed INODE, which must be on closed_inodes.
+   The caller must hold inode_table_lock. */
+static void
+inode_evict (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+  ASSERT (inode->delayed == NULL);
+
+  list_remove (&inode->lru_elem);
+  closed_cnt--;
+  hash_delete (&open_inodes, &inode->hash_elem);
+  free_extents (inode);
+  free (inode);
+}
+
+/* Drops an opener's reference to INODE, which is BROKEN, and
+   frees it if that was the last one.  A broken inode is never
+   kept once closed: opening it again should retry reading it. */
+static void
+inode_discard (struct inode *inode)
+{
+  lock_acquire (&inode_table_lock);
+  if (--inode->open_cnt == 0)
+    {
+      hash_delete (&open_inodes, &inode->hash_elem);
+      free_extents (inode);
+      free (inode);
+    }
+  lock_release (&inode_table_lock);
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
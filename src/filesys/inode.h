@@ -2,13 +2,15 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
 struct bitmap;
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+bool inode_create (block_sector_t, off_t, bool metadata);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
@@ -18,6 +20,20 @@ off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+bool inode_allocate (struct inode *, off_t length);
+bool inode_sync (struct inode *);
+void inode_flush_dirty (int64_t before);
+size_t inode_sector_cnt (const struct inode *);
+size_t inode_extent_cnt (const struct inode *);
 off_t inode_length (const struct inode *);
+void inode_lock_dir (struct inode *, bool exclusive);
+void inode_unlock_dir (struct inode *, bool exclusive);
+
+/* Consistency checking.  DATA is false for a sector that holds
+   extents rather than file data. */
+typedef void inode_extent_func (block_sector_t start, size_t cnt, bool data,
+                                void *aux);
+bool inode_check (block_sector_t, off_t *length, inode_extent_func *,
+                  void *aux);
 
 #endif /* filesys/inode.h */
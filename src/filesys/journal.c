@@ -0,0 +1,484 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Inode sectors, directory contents and the free map are never
+   written to their home locations directly.  Instead, each
+   operation that updates them runs as a transaction, bracketed
+   by journal_begin() and journal_end(), and its writes are
+   collected in memory.  Writes from any number of transactions
+   are batched and committed together: the batch is written to
+   the log, a header describing it is written after it, and only
+   then are the blocks written home.  A crash before the header
+   is on disk loses the whole batch; a crash after it is repaired
+   by journal_init() replaying the log.  Either way, a batch is
+   never seen half done.
+
+   Each transaction may log up to JOURNAL_TXN_BLOCKS blocks that
+   the batch does not already hold, and starts only when the log
+   has room for that many on top of the batch and of what the
+   transactions in progress may still log.  A batch therefore
+   always fits in the log, and blocks come from a pool with room
+   for a full log.  A write that would take a transaction past its
+   share is refused rather than logged, and the caller gives up on
+   the operation, or, if it began the transaction itself, ends it
+   at a point where the file system is consistent, begins a new one
+   and carries on.  See journal_write().
+
+   A sector written several times within one batch is logged and
+   written home only once, so batching also saves writes. */
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Number of blocks the log can hold. */
+#define JOURNAL_CAPACITY (JOURNAL_SECTORS - 1)
+
+/* Log blocks each transaction may use.  The largest operation of
+   fixed size, filesys_create(), logs a free map sector, the new
+   inode and at most DIR_OVERFLOW_MAX + 1 directory buckets (see
+   dir_add()).  Anything that may need more checks for a refused
+   write and continues in a new transaction. */
+#define JOURNAL_TXN_BLOCKS 8
+
+/* On-disk journal header, in sector JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* Magic number. */
+    uint32_t cnt;                       /* Number of blocks logged. */
+    unsigned checksum;                  /* Of SECTORS and the blocks. */
+    block_sector_t sectors[JOURNAL_CAPACITY];  /* Home sectors. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)
+                   - JOURNAL_CAPACITY * sizeof (block_sector_t)];
+  };
+
+/* A block written by a transaction that is not yet committed. */
+struct journal_block
+  {
+    struct hash_elem hash_elem;         /* Element in pending. */
+    struct list_elem list_elem;         /* Element in pending_list. */
+    block_sector_t sector;              /* Home sector. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Contents. */
+  };
+
+static struct lock journal_lock;        /* Protects everything below. */
+static struct condition journal_cond;   /* Transaction ended, or commit. */
+static struct hash pending;             /* Uncommitted blocks by sector. */
+static struct list pending_list;        /* Same, in order of first write. */
+static size_t pending_cnt;              /* Number of uncommitted blocks. */
+static int64_t pending_since;           /* Timer tick of first of them. */
+static int active_cnt;                  /* Transactions in progress. */
+static size_t promised_cnt;             /* Blocks they may still log. */
+static bool commit_wanted;              /* Hold off new transactions? */
+static struct list free_blocks;         /* Unused journal_blocks. */
+
+/* Statistics. */
+static long long commit_cnt;            /* Number of batches committed. */
+static long long logged_cnt;            /* Number of blocks logged. */
+static long long absorbed_cnt;          /* Writes to a pending block. */
+static long long refused_cnt;           /* Writes that did not fit. */
+
+static hash_hash_func journal_block_hash;
+static hash_less_func journal_block_less;
+static struct journal_block *find_block (block_sector_t);
+static void write_header (struct journal_header *, size_t cnt,
+                          unsigned checksum);
+static void replay (void);
+static void commit (void);
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal; otherwise, replays any batch that was committed but
+   not yet written home when the system last went down. */
+void
+journal_init (bool format) 
+{
+  size_t i;
+
+  /* If this assertion fails, the header is not exactly one sector
+     in size, and you should fix that. */
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  hash_init (&pending, journal_block_hash, journal_block_less, NULL);
+  list_init (&pending_list);
+  pending_cnt = 0;
+  active_cnt = 0;
+  promised_cnt = 0;
+  commit_wanted = false;
+
+  /* Enough blocks for a full log, which no batch outgrows, so
+     that journal_write() never has to allocate memory. */
+  list_init (&free_blocks);
+  for (i = 0; i < JOURNAL_CAPACITY; i++)
+    {
+      struct journal_block *b = malloc (sizeof *b);
+      if (b == NULL)
+        PANIC ("can't allocate journal blocks");
+      list_push_back (&free_blocks, &b->list_elem);
+    }
+
+  if (format)
+    {
+      struct journal_header *h = calloc (1, sizeof *h);
+      if (h == NULL)
+        PANIC ("can't allocate journal header");
+      write_header (h, 0, 0);
+      free (h);
+    }
+  else
+    replay ();
+}
+
+/* Commits any outstanding metadata writes. */
+void
+journal_done (void) 
+{
+  journal_flush ();
+}
+
+/* Starts a transaction in the running thread.  All metadata
+   written until the matching journal_end() is committed
+   atomically.  Transactions nest: only the outermost one counts,
+   and nested ones share its room in the log.
+
+   This function may sleep, so the caller must not hold locks
+   that a thread inside a transaction could wait for. */
+void
+journal_begin (void) 
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (commit_wanted
+         || pending_cnt + promised_cnt + JOURNAL_TXN_BLOCKS
+            > JOURNAL_CAPACITY)
+    {
+      if (active_cnt == 0)
+        commit ();
+      else
+        {
+          commit_wanted = true;
+          cond_wait (&journal_cond, &journal_lock);
+        }
+    }
+  active_cnt++;
+  promised_cnt += JOURNAL_TXN_BLOCKS;
+  t->journal_left = JOURNAL_TXN_BLOCKS;
+  t->journal_refused = false;
+  lock_release (&journal_lock);
+}
+
+/* Ends the running thread's transaction.  If a commit is waiting
+   for this transaction to finish and it is the last one, commits
+   the batch. */
+void
+journal_end (void) 
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (active_cnt > 0);
+  promised_cnt -= t->journal_left;
+  t->journal_left = 0;
+  if (--active_cnt == 0 && commit_wanted)
+    commit ();
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes, seeing any uncommitted write. */
+void
+journal_read (block_sector_t sector, void *buffer) 
+{
+  struct journal_block *b;
+
+  lock_acquire (&journal_lock);
+  b = find_block (sector);
+  if (b != NULL)
+    {
+      memcpy (buffer, b->data, BLOCK_SECTOR_SIZE);
+      lock_release (&journal_lock);
+      return;
+    }
+  lock_release (&journal_lock);
+
+  /* Not pending, so the disk is up to date.  The caller's inode
+     lock keeps a writer from racing with us. */
+  block_read (fs_device, sector, buffer);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR as part
+   of the running thread's transaction.
+   Returns true if successful.  Returns false, writing nothing, if
+   SECTOR is not yet in the batch and the transaction has used up
+   its room in the log.  Rewriting a sector already in the batch
+   always succeeds, so an operation can undo a change whose later
+   writes were refused by writing its sectors again. */
+bool
+journal_write (block_sector_t sector, const void *buffer) 
+{
+  struct thread *t = thread_current ();
+  struct journal_block *b;
+
+  ASSERT (t->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  b = find_block (sector);
+  if (b != NULL)
+    absorbed_cnt++;
+  else
+    {
+      if (t->journal_left == 0)
+        {
+          t->journal_refused = true;
+          refused_cnt++;
+          lock_release (&journal_lock);
+          return false;
+        }
+      t->journal_left--;
+      promised_cnt--;
+      ASSERT (!list_empty (&free_blocks));
+      b = list_entry (list_pop_front (&free_blocks),
+                      struct journal_block, list_elem);
+      b->sector = sector;
+      hash_insert (&pending, &b->hash_elem);
+      list_push_back (&pending_list, &b->list_elem);
+      if (pending_cnt++ == 0)
+        pending_since = timer_ticks ();
+    }
+  memcpy (b->data, buffer, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+  return true;
+}
+
+/* Returns true if a write in the running thread's transaction has
+   been refused for lack of room in the log. */
+bool
+journal_refused (void) 
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  return t->journal_refused;
+}
+
+/* Returns true if the running thread's transaction is nested in
+   another, so that ending it would not end the transaction. */
+bool
+journal_nested (void) 
+{
+  return thread_current ()->journal_depth > 1;
+}
+
+/* Waits for the transactions in progress to finish, then
+   commits everything written so far. */
+void
+journal_flush (void) 
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  commit_wanted = true;
+  while (commit_wanted)
+    {
+      if (active_cnt == 0)
+        commit ();
+      else
+        cond_wait (&journal_cond, &journal_lock);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Commits everything written so far, as journal_flush() does,
+   if the first uncommitted write was made before timer tick
+   BEFORE. */
+void
+journal_flush_before (int64_t before) 
+{
+  bool expired;
+
+  lock_acquire (&journal_lock);
+  expired = pending_cnt > 0 && pending_since < before;
+  lock_release (&journal_lock);
+  if (expired)
+    journal_flush ();
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) 
+{
+  printf ("Journal: %lld commits, %lld blocks logged, "
+          "%lld writes absorbed, %lld writes refused\n",
+          commit_cnt, logged_cnt, absorbed_cnt, refused_cnt);
+}
+
+/* Returns the pending block for SECTOR, or a null pointer if
+   there is none.  The caller must hold journal_lock. */
+static struct journal_block *
+find_block (block_sector_t sector) 
+{
+  struct journal_block key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&pending, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct journal_block, hash_elem) : NULL;
+}
+
+/* Writes header H to disk, describing CNT logged blocks with the
+   given CHECKSUM. */
+static void
+write_header (struct journal_header *h, size_t cnt, unsigned checksum) 
+{
+  h->magic = JOURNAL_MAGIC;
+  h->cnt = cnt;
+  h->checksum = checksum;
+  block_write (fs_device, JOURNAL_SECTOR, h);
+}
+
+/* Returns CHECKSUM updated for logging DATA to SECTOR. */
+static unsigned
+checksum_block (unsigned checksum, block_sector_t sector, const void *data) 
+{
+  checksum = checksum * 31 + hash_int (sector);
+  return checksum * 31 + hash_bytes (data, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes the blocks of a committed batch to their home
+   locations, if the journal holds one. */
+static void
+replay (void) 
+{
+  struct journal_header *h = malloc (sizeof *h);
+  uint8_t *data = malloc (BLOCK_SECTOR_SIZE);
+  unsigned checksum = 0;
+  size_t i;
+
+  if (h == NULL || data == NULL)
+    PANIC ("can't allocate journal buffers");
+
+  block_read (fs_device, JOURNAL_SECTOR, h);
+  if (h->magic != JOURNAL_MAGIC)
+    PANIC ("no journal found--file system needs to be reformatted");
+
+  if (h->cnt > 0 && h->cnt <= JOURNAL_CAPACITY)
+    {
+      /* A header whose checksum does not match was torn while
+         being written, so its batch never committed. */
+      for (i = 0; i < h->cnt; i++)
+        {
+          block_read (fs_device, JOURNAL_SECTOR + 1 + i, data);
+          checksum = checksum_block (checksum, h->sectors[i], data);
+        }
+      if (checksum == h->checksum)
+        {
+          for (i = 0; i < h->cnt; i++)
+            {
+              block_read (fs_device, JOURNAL_SECTOR + 1 + i, data);
+              block_write (fs_device, h->sectors[i], data);
+            }
+          printf ("journal: replayed %u blocks\n", (unsigned) h->cnt);
+        }
+    }
+  if (h->cnt != 0)
+    write_header (h, 0, 0);
+
+  free (data);
+  free (h);
+}
+
+/* Commits all pending blocks.  No transaction may be in
+   progress.  The caller must hold journal_lock. */
+static void
+commit (void) 
+{
+  struct journal_header *h;
+
+  ASSERT (active_cnt == 0);
+  ASSERT (pending_cnt <= JOURNAL_CAPACITY);
+
+  if (pending_cnt > 0)
+    {
+      struct list_elem *e;
+      unsigned checksum = 0;
+      size_t cnt = 0;
+
+      h = calloc (1, sizeof *h);
+      if (h == NULL)
+        PANIC ("can't allocate journal header");
+
+      /* Log the blocks, then commit them by writing the header. */
+      for (e = list_begin (&pending_list); e != list_end (&pending_list);
+           e = list_next (e))
+        {
+          struct journal_block *b
+            = list_entry (e, struct journal_block, list_elem);
+          block_write (fs_device, JOURNAL_SECTOR + 1 + cnt, b->data);
+          h->sectors[cnt++] = b->sector;
+          checksum = checksum_block (checksum, b->sector, b->data);
+        }
+      write_header (h, cnt, checksum);
+      logged_cnt += cnt;
+
+      /* Write the blocks home.  Once that is done the log is no
+         longer needed. */
+      while (!list_empty (&pending_list))
+        {
+          struct journal_block *b
+            = list_entry (list_pop_front (&pending_list),
+                          struct journal_block, list_elem);
+          block_write (fs_device, b->sector, b->data);
+          hash_delete (&pending, &b->hash_elem);
+          list_push_back (&free_blocks, &b->list_elem);
+        }
+      pending_cnt = 0;
+      write_header (h, 0, 0);
+      free (h);
+      commit_cnt++;
+    }
+
+  /* Sectors freed by the batch may now be reused.  No transaction
+     is in progress, so nobody holds the free map lock. */
+  free_map_commit ();
+
+  commit_wanted = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+}
+
+/* Returns a hash value for journal block E. */
+static unsigned
+journal_block_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct journal_block, hash_elem)->sector);
+}
+
+/* Returns true if journal block A's sector precedes B's. */
+static bool
+journal_block_less (const struct hash_elem *a, const struct hash_elem *b,
+                    void *aux UNUSED)
+{
+  return (hash_entry (a, struct journal_block, hash_elem)->sector
+          < hash_entry (b, struct journal_block, hash_elem)->sector);
+}
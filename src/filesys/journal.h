@@ -0,0 +1,23 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Sectors reserved for the journal, starting at JOURNAL_SECTOR
+   (see filesys.h): one header sector followed by the log. */
+#define JOURNAL_SECTORS 64
+
+void journal_init (bool format);
+void journal_done (void);
+void journal_begin (void);
+void journal_end (void);
+void journal_read (block_sector_t, void *);
+bool journal_write (block_sector_t, const void *);
+bool journal_refused (void);
+bool journal_nested (void);
+void journal_flush (void);
+void journal_flush_before (int64_t);
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
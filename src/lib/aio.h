@@ -0,0 +1,30 @@
+#ifndef __LIB_AIO_H
+#define __LIB_AIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* An asynchronous read or write, for aio_submit(). */
+struct aiocb
+  {
+    int aio_fd;                 /* File descriptor. */
+    void *aio_buf;              /* Buffer. */
+    size_t aio_nbytes;          /* Length of buffer in bytes. */
+    unsigned aio_offset;        /* File position to start at. */
+    bool aio_write;             /* Write the buffer, or read into it? */
+  };
+
+/* Maximum number of requests a process may have outstanding. */
+#define AIO_MAX 64
+
+/* Maximum length of a single request, in bytes. */
+#define AIO_MAX_BYTES (64 * 1024)
+
+/* Maximum number of buffer pages a process's outstanding requests
+   may keep pinned in memory between them. */
+#define AIO_MAX_PAGES 64
+
+/* Returned by aio_poll() for a request that has not finished. */
+#define AIO_PENDING (-2)
+
+#endif /* lib/aio.h */
@@ -359,6 +359,25 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to FILE, where bitmap_write() would put it.  Returns true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t start, size_t cnt)
+{
+  size_t first, size;
+
+  ASSERT (b != NULL);
+  ASSERT (cnt > 0);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  first = elem_idx (start);
+  size = (elem_idx (start + cnt - 1) - first + 1) * sizeof (elem_type);
+  return (file_write_at (file, b->bits + first, size,
+                         first * sizeof (elem_type)) == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
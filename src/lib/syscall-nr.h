@@ -3,7 +3,7 @@
 
 
 //Number of system calls
-#define NOA 24
+#define NOA 32
 
 /* System call numbers. */
 enum
@@ -32,7 +32,20 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FALLOCATE,              /* Reserves disk space for a file. */
+    SYS_PREAD,                  /* Read from a file at a position. */
+    SYS_PWRITE,                 /* Write to a file at a position. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write to a file from several buffers. */
+    SYS_COPY_FILE,              /* Copy data from one file to another. */
+    SYS_FSYNC,                  /* Write a file's data to disk. */
+    SYS_SYNC,                   /* Write all file system data to disk. */
+    SYS_AIO_SUBMIT,             /* Start an asynchronous read or write. */
+    SYS_AIO_WAIT,               /* Wait for an asynchronous request. */
+    SYS_AIO_POLL                /* Check on an asynchronous request. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <iovec.h>
+#include <aio.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +47,17 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool fallocate (int fd, unsigned size);
+int pread (int fd, void *buffer, unsigned length, unsigned position);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned position);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file (int src_fd, int dst_fd, unsigned length);
+bool fsync (int fd);
+void sync (void);
+int aio_submit (const struct aiocb *);
+int aio_wait (int id);
+int aio_poll (int id);
+
 #endif /* lib/user/syscall.h */
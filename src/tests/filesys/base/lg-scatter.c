@@ -0,0 +1,53 @@
+/* Writes one byte at each of many widely spaced offsets in a
+   file that starts out as one big hole.  Each byte gets sectors
+   of its own, so the file needs more extents than fit in its
+   inode.  Then reads the whole file back to verify that every
+   byte was written and that the rest reads as zeros. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SPACING 8192            /* Bytes from one write to the next. */
+#define WRITE_CNT 64            /* Number of bytes written. */
+#define TEST_SIZE (SPACING * WRITE_CNT)
+
+void
+test_main (void) 
+{
+  const char *file_name = "scatter";
+  char block[512];
+  size_t ofs, i;
+  int fd;
+
+  CHECK (create (file_name, TEST_SIZE), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  msg ("write %d bytes %d bytes apart", WRITE_CNT, SPACING);
+  for (i = 0; i < WRITE_CNT; i++) 
+    {
+      char c = 'a' + i % 26;
+      seek (fd, i * SPACING);
+      if (write (fd, &c, 1) != 1)
+        fail ("write 1 byte at offset %zu failed", i * SPACING);
+    }
+
+  msg ("read \"%s\"", file_name);
+  seek (fd, 0);
+  for (ofs = 0; ofs < TEST_SIZE; ofs += sizeof block) 
+    {
+      if (read (fd, block, sizeof block) != sizeof block)
+        fail ("read %zu bytes at offset %zu failed", sizeof block, ofs);
+      for (i = 0; i < sizeof block; i++) 
+        {
+          size_t pos = ofs + i;
+          char expected = pos % SPACING == 0 ? 'a' + pos / SPACING % 26 : 0;
+          if (block[i] != expected)
+            fail ("byte %zu is %d, expected %d", pos, block[i], expected);
+        }
+    }
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-scatter) begin
+(lg-scatter) create "scatter"
+(lg-scatter) open "scatter"
+(lg-scatter) write 64 bytes 8192 bytes apart
+(lg-scatter) read "scatter"
+(lg-scatter) close "scatter"
+(lg-scatter) end
+EOF
+pass;
@@ -0,0 +1,56 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* 17.14 fixed-point arithmetic, for the multi-level feedback
+   queue scheduler's load_avg and recent_cpu.
+
+   A fixed-point number X stands for the real number X / 2**14:
+   17 bits before the binary point, 14 after it, and a sign bit.
+   Sums and differences of two fixed-point numbers, and products
+   and quotients of a fixed-point number and an integer, are
+   computed with plain int arithmetic.  Products and quotients of
+   two fixed-point numbers go through 64 bits so that the
+   intermediate result does not overflow. */
+typedef int fixed_point;
+
+#define FP_SHIFT 14                     /* Bits after the point. */
+#define FP_ONE (1 << FP_SHIFT)          /* 1.0. */
+
+/* Returns integer N as a fixed-point number. */
+static inline fixed_point
+fp_from_int (int n)
+{
+  return n * FP_ONE;
+}
+
+/* Returns X truncated toward zero. */
+static inline int
+fp_trunc (fixed_point x)
+{
+  return x / FP_ONE;
+}
+
+/* Returns X rounded to the nearest integer. */
+static inline int
+fp_round (fixed_point x)
+{
+  return (x >= 0 ? x + FP_ONE / 2 : x - FP_ONE / 2) / FP_ONE;
+}
+
+/* Returns X * Y. */
+static inline fixed_point
+fp_mul (fixed_point x, fixed_point y)
+{
+  return (int64_t) x * y / FP_ONE;
+}
+
+/* Returns X / Y. */
+static inline fixed_point
+fp_div (fixed_point x, fixed_point y)
+{
+  return (int64_t) x * FP_ONE / y;
+}
+
+#endif /* threads/fixed-point.h */
@@ -23,6 +23,7 @@
 #include "threads/pte.h"
 #include "threads/thread.h"
 #ifdef USERPROG
+#include "userprog/aio.h"
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
@@ -132,6 +133,7 @@ main (void)
 #ifdef USERPROG
   swap_init();
   frame_init();
+  aio_init ();
 #endif
 
   printf ("Boot complete.\n");
@@ -254,6 +256,8 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-flush"))
+        filesys_flush_ms = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -263,6 +267,10 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-nodefer"))
+        intr_no_defer = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -316,8 +324,13 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"timer-bench", 1, timer_bench},
+      {"thread-bench", 1, thread_bench},
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
+      {"frag", 1, fsutil_frag},
+      {"fsck", 1, fsutil_fsck},
+      {"fsck-repair", 1, fsutil_fsck_repair},
       {"cat", 2, fsutil_cat},
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
@@ -364,8 +377,13 @@ usage (void)
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  timer-bench        Benchmark adding and cancelling timeouts.\n"
+          "  thread-bench       Benchmark creating and destroying threads.\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
+          "  frag               Report how fragmented those files are.\n"
+          "  fsck               Check the file system and report problems.\n"
+          "  fsck-repair        Check the file system and repair problems.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
@@ -380,12 +398,15 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -flush=MS          Write back data dirty for MS ms (0: never).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer interrupt while idle.\n"
+          "  -nodefer           Run deferred interrupt work at once.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -6,6 +6,7 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
@@ -47,6 +48,47 @@ static unsigned int unexpected_cnt[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Deferred work.
+
+   Queued work items are run by run_deferred(), with interrupts
+   on, on the way out of an external interrupt, up to
+   DEFER_BUDGET of them at a time so that a flood of work cannot
+   hold up the interrupted thread for long.  Whatever is left, or
+   is queued outside an interrupt, is run by the "deferred"
+   thread at PRI_MAX.  Only one item runs at a time. */
+#define DEFER_BUDGET 16
+
+static struct list deferred_list;       /* Queued work items. */
+static struct semaphore deferred_sema;  /* Wakes the deferred thread. */
+static bool deferred_busy;              /* Is an item being run? */
+static bool in_deferred;                /* Running items after an intr? */
+
+/* If true, intr_defer() calls the function at once instead, as if
+   there were no deferred work, for comparison.  Controlled by
+   kernel command-line option "-nodefer". */
+bool intr_no_defer;
+
+static long long deferred_cnt;          /* # of items queued. */
+static long long deferred_thread_cnt;   /* # of them run by the thread. */
+
+/* Number of each external interrupt, and most CPU cycles it kept
+   interrupts off for, as measured with the time-stamp counter. */
+static long long ext_cnt[16];
+static uint64_t ext_off_max[16];
+
+static void record_off_time (int irq, uint64_t cycles);
+static void run_deferred (void);
+static thread_func deferred_thread;
+
+/* Returns the CPU's time-stamp counter.  See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -123,6 +165,14 @@ intr_init (void)
   /* Initialize interrupt controller. */
   pic_init ();
 
+  /* Initialize deferred work.  Its thread first runs once the
+     scheduler is started. */
+  list_init (&deferred_list);
+  sema_init (&deferred_sema, 0);
+  if (thread_create ("deferred", PRI_MAX, deferred_thread, NULL)
+      == TID_ERROR)
+    PANIC ("couldn't start deferred work thread");
+
   /* Initialize IDT. */
   for (i = 0; i < INTR_CNT; i++)
     idt[i] = make_intr_gate (intr_stubs[i], 0);
@@ -216,14 +266,78 @@ intr_context (void)
 
 /* During processing of an external interrupt, directs the
    interrupt handler to yield to a new process just before
-   returning from the interrupt.  May not be called at any other
+   returning from the interrupt.  May also be called by deferred
+   work run on the way out of an interrupt, but not at any other
    time. */
 void
 intr_yield_on_return (void) 
 {
-  ASSERT (intr_context ());
+  ASSERT (intr_context () || in_deferred);
   yield_on_return = true;
 }
+
+/* Initializes work item W to call FUNCTION, passing AUX. */
+void
+intr_work_init (struct intr_work *w, intr_work_func *function, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (function != NULL);
+
+  w->function = function;
+  w->aux = aux;
+  w->queued = false;
+}
+
+/* Queues work item W, unless it is already queued.  Meant to be
+   called from an external interrupt handler; if called
+   elsewhere, the deferred thread runs W. */
+void
+intr_defer (struct intr_work *w)
+{
+  enum intr_level old_level;
+
+  if (intr_no_defer)
+    {
+      w->function (w->aux);
+      return;
+    }
+
+  old_level = intr_disable ();
+  if (!w->queued)
+    {
+      w->queued = true;
+      list_push_back (&deferred_list, &w->elem);
+      deferred_cnt++;
+      if (!in_external_intr && !in_deferred)
+        sema_up (&deferred_sema);
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns true while deferred work runs on the way out of an
+   external interrupt, false at all other times.  Like an
+   interrupt handler, such work should yield with
+   intr_yield_on_return(). */
+bool
+intr_deferred_context (void)
+{
+  return in_deferred;
+}
+
+/* Prints interrupt statistics. */
+void
+intr_print_stats (void)
+{
+  int irq;
+
+  for (irq = 0; irq < 16; irq++)
+    if (ext_cnt[irq] > 0)
+      printf ("Interrupts: %s: %lld, at most %'"PRIu64" cycles with "
+              "interrupts off\n",
+              intr_names[0x20 + irq], ext_cnt[irq], ext_off_max[irq]);
+  printf ("Interrupts: %lld deferred work items, %lld run by thread\n",
+          deferred_cnt, deferred_thread_cnt);
+}
 
 /* 8259A Programmable Interrupt Controller. */
 
@@ -346,6 +460,7 @@ intr_handler (struct intr_frame *frame)
 {
   bool external;
   intr_handler_func *handler;
+  uint64_t start = 0;
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
@@ -357,8 +472,12 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (!intr_context ());
 
+      /* An interrupt during deferred work leaves yielding to the
+         deferred work's interrupt. */
       in_external_intr = true;
-      yield_on_return = false;
+      if (!in_deferred)
+        yield_on_return = false;
+      start = rdtsc ();
     }
 
   /* Invoke the interrupt's handler. */
@@ -383,11 +502,84 @@ intr_handler (struct intr_frame *frame)
       in_external_intr = false;
       pic_end_of_interrupt (frame->vec_no); 
 
-      if (yield_on_return) 
+      /* Interrupts stay off from here until we return from the
+         interrupt or run deferred work, except for switching
+         threads. */
+      record_off_time (frame->vec_no - 0x20, rdtsc () - start);
+      if (!list_empty (&deferred_list) && !deferred_busy)
+        run_deferred ();
+
+      if (yield_on_return && !in_deferred) 
         thread_yield (); 
     }
 }
 
+/* Records that external interrupt IRQ kept interrupts off for
+   CYCLES CPU cycles. */
+static void
+record_off_time (int irq, uint64_t cycles)
+{
+  ext_cnt[irq]++;
+  if (cycles > ext_off_max[irq])
+    ext_off_max[irq] = cycles;
+}
+
+/* Runs queued work items on the way out of an external interrupt,
+   with interrupts on, leaving any past DEFER_BUDGET to the
+   deferred thread.  Must be called with interrupts off, and
+   returns with them off. */
+static void
+run_deferred (void)
+{
+  int budget;
+
+  deferred_busy = in_deferred = true;
+  for (budget = DEFER_BUDGET; !list_empty (&deferred_list); budget--)
+    {
+      struct intr_work *w;
+
+      if (budget == 0)
+        {
+          sema_up (&deferred_sema);
+          break;
+        }
+      w = list_entry (list_pop_front (&deferred_list), struct intr_work, elem);
+      w->queued = false;
+      intr_enable ();
+      w->function (w->aux);
+      intr_disable ();
+    }
+  deferred_busy = in_deferred = false;
+}
+
+/* Runs the work items that run_deferred() leaves, or that are
+   queued outside an external interrupt. */
+static void
+deferred_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct intr_work *w;
+
+      intr_disable ();
+      if (list_empty (&deferred_list))
+        {
+          intr_enable ();
+          sema_down (&deferred_sema);
+          continue;
+        }
+      w = list_entry (list_pop_front (&deferred_list), struct intr_work, elem);
+      w->queued = false;
+      deferred_thread_cnt++;
+      deferred_busy = true;
+      intr_enable ();
+      w->function (w->aux);
+      intr_disable ();
+      deferred_busy = false;
+      intr_enable ();
+    }
+}
+
 /* Handles an unexpected interrupt with interrupt frame F.  An
    unexpected interrupt is one that has no registered handler. */
 static void
@@ -1,6 +1,7 @@
 #ifndef THREADS_INTERRUPT_H
 #define THREADS_INTERRUPT_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -64,6 +65,31 @@ void intr_register_int (uint8_t vec, int dpl, enum intr_level,
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+/* Deferred work.
+
+   An external interrupt handler that has more to do than it
+   should with interrupts off can queue a work item with
+   intr_defer().  Its function is called soon after, with
+   interrupts on: normally just after the handler returns, before
+   the interrupt does, or else by the "deferred" kernel thread.
+   Like an interrupt handler, it must not sleep. */
+typedef void intr_work_func (void *aux);
+
+struct intr_work
+  {
+    struct list_elem elem;      /* In the deferred work queue. */
+    intr_work_func *function;   /* Function to call. */
+    void *aux;                  /* Argument to pass it. */
+    bool queued;                /* In the queue? */
+  };
+
+extern bool intr_no_defer;
+
+void intr_work_init (struct intr_work *, intr_work_func *, void *aux);
+void intr_defer (struct intr_work *);
+bool intr_deferred_context (void);
+void intr_print_stats (void);
+
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
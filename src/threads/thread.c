@@ -11,10 +11,12 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
 #include "devices/timer.h"
 #include "threads/malloc.h"
 #include "threads/pte.h"
 #ifdef USERPROG
+#include "userprog/aio.h"
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
@@ -25,9 +27,23 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, in one FIFO queue per
+   priority.  Bit P of ready_mask is set if and only if
+   ready_queues[P] is not empty, so the highest priority with a
+   ready thread is found from the mask alone and every run queue
+   operation takes constant time. */
+#if PRI_MIN != 0 || PRI_MAX >= 64
+#error ready_mask needs a bit for each priority
+#endif
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;           /* Number of threads in ready_queues. */
+
+/* List of threads blocked in thread_sleep(), in order of
+   increasing wake_tick, so that the timer interrupt only has to
+   look at the front of the list to find those due to wake. */
+static struct list sleep_list;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -42,6 +58,20 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Pages of dead threads, kept for new threads so that creating
+   and destroying threads need not go through the page allocator.
+   A recycled page keeps its old contents, but init_thread()
+   clears the struct thread at its start and the rest is stack,
+   which a new thread sets up from scratch, so pages for threads
+   are never zeroed as a whole.  Protected by disabling
+   interrupts. */
+#define THREAD_CACHE_SIZE 8
+static struct thread *thread_cache[THREAD_CACHE_SIZE];
+static int thread_cache_cnt;    /* # of pages in thread_cache. */
+static bool thread_cache_off;   /* Cache disabled, for benchmarking? */
+static long long thread_cache_hits;     /* # of pages taken from it. */
+static long long thread_cache_misses;   /* # of pages from palloc. */
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame
   {
@@ -55,8 +85,14 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
+/* Priority donation statistics. */
+static long long donation_cnt;  /* # of lock waits that donated. */
+static int donation_depth_max;  /* Longest chain donated through. */
+static long long donation_cut_cnt;  /* # of chains cut short. */
+
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+#define DONATION_DEPTH 8        /* Max # of locks to donate through. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
 /* If false (default), use round-robin scheduler.
@@ -64,11 +100,23 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Estimated number of threads ready to run over the past minute,
+   for the multi-level feedback queue scheduler. */
+static fixed_point load_avg;
+
 static void kernel_thread (thread_func *, void *aux);
+static struct thread *alloc_thread_page (void);
+static void free_thread_page (struct thread *);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static int highest_ready (void);
+static void change_priority (struct thread *, int priority);
+static int mlfqs_priority (const struct thread *);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_second (struct thread *);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
@@ -91,10 +139,15 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
+  list_init (&sleep_list);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -140,17 +193,110 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
+/* Accounts for a timer tick that passed, with the idle thread
+   running, while the timer interrupt was stopped (see
+   timer_idle_enter()).  Runs with interrupts off, but not
+   necessarily in an interrupt context. */
+void
+thread_idle_tick (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idle_ticks++;
+  if (thread_mlfqs && timer_ticks () % TIMER_FREQ == 0)
+    mlfqs_second (idle_thread);
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld pages recycled, %lld from palloc\n",
+          thread_cache_hits, thread_cache_misses);
+  printf ("Donation: %lld donations, deepest chain %d, %lld chains cut\n",
+          donation_cnt, donation_depth_max, donation_cut_cnt);
+  workqueue_print_stats ();
+}
+
+/* Thread benchmark, for the "thread-bench" action. */
+#define BENCH_THREADS 10000     /* Threads to create in each round. */
+
+/* Thread function for thread_bench(): lets it go on and exits. */
+static void
+bench_thread (void *done_)
+{
+  sema_up (done_);
+}
+
+/* Creates BENCH_THREADS threads that exit at once, one at a time,
+   and returns how many ticks that took. */
+static int64_t
+bench_round (void)
+{
+  struct semaphore done;
+  int64_t start = timer_ticks ();
+  int64_t elapsed;
+  int i;
+
+  sema_init (&done, 0);
+  for (i = 0; i < BENCH_THREADS; i++)
+    {
+      if (thread_create ("bench", PRI_DEFAULT, bench_thread, &done)
+          == TID_ERROR)
+        PANIC ("thread-bench: out of memory");
+      sema_down (&done);
+    }
+  elapsed = timer_elapsed (start);
+
+#ifdef USERPROG
+  /* Throw away the exit statuses the threads left us. */
+  while (!list_empty (&thread_current ()->children_return))
+    free (list_entry (list_pop_front (&thread_current ()->children_return),
+                      struct return_status, elem));
+#endif
+  return elapsed;
+}
+
+/* Prints the throughput of a round of thread_bench() that took
+   ELAPSED ticks. */
+static void
+bench_report (const char *what, int64_t elapsed)
+{
+  printf ("thread-bench: %d threads %s took %lld ticks", BENCH_THREADS,
+          what, elapsed);
+  if (elapsed > 0)
+    printf (", %lld per second",
+            (long long) BENCH_THREADS * TIMER_FREQ / elapsed);
+  printf ("\n");
+}
+
+/* Times creating and destroying threads, first allocating every
+   thread's page from palloc, as without the thread page cache,
+   then recycling them. */
+void
+thread_bench (char **argv UNUSED)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  thread_cache_off = true;
+  while (thread_cache_cnt > 0)
+    palloc_free_page (thread_cache[--thread_cache_cnt]);
+  intr_set_level (old_level);
+  bench_report ("without the page cache", bench_round ());
+
+  thread_cache_off = false;
+  bench_report ("with the page cache", bench_round ());
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -165,9 +311,10 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread has a higher priority than the running
+   thread, it preempts it.  With the multi-level feedback queue
+   scheduler, PRIORITY is ignored, and the new thread starts out
+   with the running thread's nice value and recent CPU time. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux)
@@ -182,7 +329,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL){
     return TID_ERROR;
   }
@@ -242,10 +389,13 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, the
+   running thread is preempted, but only if interrupts were on
+   or this is an interrupt handler.  This can be important: if
+   the caller had disabled interrupts itself, it may expect that
+   it can atomically unblock a thread and update other data.
+   Such a caller should call thread_preempt() once it turns
+   interrupts back on. */
 void
 thread_unblock (struct thread *t)
 {
@@ -255,9 +405,90 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
+  if (old_level == INTR_ON || intr_context ())
+    thread_preempt ();
+}
+
+/* Yields the CPU if a ready thread has a higher priority than the
+   running thread.  In an interrupt handler or deferred work run
+   on the way out of one, yields on return from the interrupt
+   instead.  Does nothing if interrupts are off outside an
+   interrupt handler. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level = intr_disable ();
+  struct thread *cur = running_thread ();
+  bool preempt = (ready_mask != 0
+                  && (cur == idle_thread || highest_ready () > cur->priority));
+
+  intr_set_level (old_level);
+  if (!preempt)
+    return;
+  if (intr_context () || intr_deferred_context ())
+    intr_yield_on_return ();
+  else if (old_level == INTR_ON)
+    thread_yield ();
+}
+
+/* Returns true if thread A is due to wake before thread B. */
+static bool
+wakes_earlier (const struct list_elem *a, const struct list_elem *b,
+               void *aux UNUSED)
+{
+  return (list_entry (a, struct thread, elem)->wake_tick
+          < list_entry (b, struct thread, elem)->wake_tick);
+}
+
+/* Blocks the running thread until timer tick WAKE_TICK.
+   Interrupts must be turned on. */
+void
+thread_sleep (int64_t wake_tick)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  cur->wake_tick = wake_tick;
+  list_insert_ordered (&sleep_list, &cur->elem, wakes_earlier, NULL);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Unblocks every sleeping thread due to wake at or before tick
+   NOW.  Called by the timer interrupt handler, so it only looks
+   at the threads it wakes and the one after them. */
+void
+thread_wake (int64_t now)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (!list_empty (&sleep_list))
+    {
+      struct thread *t = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      if (t->wake_tick > now)
+        break;
+      list_pop_front (&sleep_list);
+      thread_unblock (t);
+    }
+}
+
+/* Returns the tick at which the first sleeping thread is due to
+   wake, or INT64_MAX if none is sleeping. */
+int64_t
+thread_next_wake (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (&sleep_list))
+    return INT64_MAX;
+  return list_entry (list_front (&sleep_list), struct thread, elem)->wake_tick;
 }
 
 /* Returns the name of the running thread. */
@@ -313,6 +544,9 @@ thread_exit (void)
     list_push_back (&t->parent->children_return, &return_status->elem);
   }
 
+  /* Finish with asynchronous I/O before its buffers go away. */
+  aio_exit ();
+
   while (!list_empty (&t->mmap_files))
   {
     e = list_pop_front (&t->mmap_files);
@@ -333,19 +567,10 @@ thread_exit (void)
       sema_up (&t->pagedir_mod);
       if(pg_ofs (kpage) == 0 && dirty) {
         int zero_after = ( i == pages - 1) ? fl%PGSIZE : PGSIZE;
-        file_seek (fh->file, i*PGSIZE);
 
-        lock_frames ();
         frame_pin (uaddr, PGSIZE);
-        unlock_frames ();
-
-        filesys_lock_acquire ();
-        file_write (fh->file, uaddr, zero_after);
-        filesys_lock_release ();
-
-        lock_frames ();
+        file_write_at (fh->file, uaddr, zero_after, i*PGSIZE);
         frame_unpin (uaddr, PGSIZE);
-        unlock_frames ();
       }
       sema_down (&t->pagedir_mod);
       pagedir_clear_page (t->pagedir, uaddr);
@@ -360,6 +585,10 @@ thread_exit (void)
 
   process_exit ();
 
+  /* Code pages can no longer fault in, so the executable may go. */
+  file_close (t->exec_file);
+  t->exec_file = NULL;
+
   //Close open files
   while (!list_empty (&t->files))
   {
@@ -383,7 +612,9 @@ thread_exit (void)
   intr_disable ();
 
   list_remove (&t->allelem);
+#ifdef USERPROG
   list_remove (&t->child);
+#endif
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -401,7 +632,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread)
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -424,11 +655,144 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY,
+   yielding if it is no longer the highest.  Priority donated to
+   the thread still applies until the lock it came through is
+   released. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+  thread_current ()->base_priority = new_priority;
+  thread_update_priority ();
+}
+
+/* Returns true if the thread with list element A has a higher
+   priority than the one with B.  Used to keep lists of waiting
+   threads in order of priority. */
+bool
+thread_priority_greater (const struct list_elem *a,
+                         const struct list_elem *b, void *aux UNUSED)
+{
+  return (list_entry (a, struct thread, elem)->priority
+          > list_entry (b, struct thread, elem)->priority);
+}
+
+/* Changes the priority of T, which is not running, to PRIORITY,
+   moving it to the right run queue if it is ready, or to the
+   right place among a semaphore's waiters if it is waiting for
+   one.  Interrupts must be off. */
+static void
+change_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->status == THREAD_READY)
+    {
+      list_remove (&t->elem);
+      ready_cnt--;
+      if (list_empty (&ready_queues[t->priority]))
+        ready_mask &= ~((uint64_t) 1 << t->priority);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else if (t->waiting_sema != NULL)
+    {
+      list_remove (&t->elem);
+      t->priority = priority;
+      list_insert_ordered (&t->waiting_sema->waiters, &t->elem,
+                           thread_priority_greater, NULL);
+    }
+  else
+    t->priority = priority;
+}
+
+/* Donates the priority of DONOR, which is about to wait for
+   DONOR->waiting_lock, to the holder of that lock and on down
+   the chain of holders that are themselves waiting for locks.
+   Stops where the priority would not rise anyway or after
+   DONATION_DEPTH locks, so that a long chain cannot hold up the
+   scheduler.  Interrupts must be off. */
+void
+thread_donate_priority (struct thread *donor)
+{
+  struct lock *lock = donor->waiting_lock;
+  int priority = donor->priority;
+  int depth = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (lock != NULL && lock->holder != NULL && lock->priority < priority)
+    {
+      struct thread *holder = lock->holder;
+
+      if (depth == DONATION_DEPTH)
+        {
+          donation_cut_cnt++;
+          break;
+        }
+      depth++;
+      lock->priority = priority;
+      if (holder->priority >= priority)
+        break;
+      change_priority (holder, priority);
+      lock = holder->waiting_lock;
+    }
+
+  if (depth > 0)
+    {
+      donation_cnt++;
+      if (depth > donation_depth_max)
+        donation_depth_max = depth;
+    }
+}
+
+/* Recomputes the running thread's priority from its base
+   priority and the priorities donated through the locks it
+   holds, yielding if it is no longer the highest. */
+void
+thread_update_priority (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->priority = thread_priority_without (NULL);
+  intr_set_level (old_level);
+  thread_preempt ();
+}
+
+/* Returns the priority the running thread would have without
+   the donations made through LOCK, which it holds, that is, once
+   it releases LOCK.  LOCK may be null, to count every donation. */
+int
+thread_priority_without (const struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  struct list_elem *e;
+  int priority;
+
+  if (thread_mlfqs)
+    return cur->priority;
+
+  old_level = intr_disable ();
+  priority = cur->base_priority;
+  for (e = list_begin (&cur->locks); e != list_end (&cur->locks);
+       e = list_next (e))
+    {
+      struct lock *l = list_entry (e, struct lock, elem);
+      if (l != lock && l->priority > priority)
+        priority = l->priority;
+    }
+  intr_set_level (old_level);
+  return priority;
 }
 
 /* Returns the current thread's priority. */
@@ -438,35 +802,121 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, clamped to the
+   range NICE_MIN to NICE_MAX, and recomputes its priority,
+   yielding if it is no longer the highest. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (nice < NICE_MIN)
+    nice = NICE_MIN;
+  else if (nice > NICE_MAX)
+    nice = NICE_MAX;
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    cur->priority = mlfqs_priority (cur);
+  intr_set_level (old_level);
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+  return recent;
+}
+
+/* Returns the priority that the multi-level feedback queue
+   scheduler gives T, from its recent CPU time and nice value. */
+static int
+mlfqs_priority (const struct thread *t)
+{
+  int priority = fp_trunc (fp_from_int (PRI_MAX) - t->recent_cpu / 4)
+                 - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Updates the multi-level feedback queue scheduler's state at a
+   timer tick with T running.
+
+   Only the running thread's recent CPU time grows at a tick, so
+   every TIME_SLICE ticks only its priority is recomputed.  Once
+   a second mlfqs_second() recomputes every priority. */
+static void
+mlfqs_tick (struct thread *t)
+{
+  int64_t now = timer_ticks ();
+
+  if (t != idle_thread)
+    t->recent_cpu += FP_ONE;
+
+  if (now % TIMER_FREQ == 0)
+    mlfqs_second (t);
+  else if (now % TIME_SLICE == 0 && t != idle_thread)
+    t->priority = mlfqs_priority (t);
+
+  thread_preempt ();
+}
+
+/* Updates the load average and decays every thread's recent CPU
+   time, with T running, then recomputes every priority, with the
+   decay factor worked out once for all of them. */
+static void
+mlfqs_second (struct thread *t)
+{
+  int ready = ready_cnt + (t != idle_thread);
+  fixed_point decay;
+  struct list_elem *e;
+
+  load_avg = (fp_mul (fp_div (fp_from_int (59), fp_from_int (60)), load_avg)
+              + fp_from_int (ready) / 60);
+  decay = fp_div (2 * load_avg, 2 * load_avg + FP_ONE);
+
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *u = list_entry (e, struct thread, allelem);
+      int priority;
+
+      if (u == idle_thread)
+        continue;
+      u->recent_cpu = fp_mul (decay, u->recent_cpu) + fp_from_int (u->nice);
+      priority = mlfqs_priority (u);
+      if (u == t)
+        u->priority = priority;
+      else if (priority != u->priority)
+        change_priority (u, priority);
+    }
 }
 
 
@@ -492,6 +942,11 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing to run until an interrupt comes along, so in
+         tickless mode stop the timer interrupt until it is
+         needed. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -545,17 +1000,33 @@ is_thread (struct thread *t)
 static void
 init_thread (struct thread *t, const char *name, int priority)
 {
+  struct thread *parent = running_thread ();
   enum intr_level old_level;
+  int nice = NICE_DEFAULT;
+  fixed_point recent_cpu = 0;
 
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
 
+  if (t != parent && is_thread (parent))
+    {
+      nice = parent->nice;
+      recent_cpu = parent->recent_cpu;
+    }
+
   memset (t, 0, sizeof *t);
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->nice = nice;
+  t->recent_cpu = recent_cpu;
+  if (thread_mlfqs)
+    priority = mlfqs_priority (t);
+  t->priority = t->base_priority = priority;
+  list_init (&t->locks);
+  t->waiting_lock = NULL;
+  t->waiting_sema = NULL;
 
   #ifdef USERPROG
   sema_init (&t->pagedir_mod, 1);
@@ -564,8 +1035,11 @@ init_thread (struct thread *t, const char *name, int priority)
   list_init (&t->files);
   list_init (&t->mmap_files);
   list_init (&t->children_return);
+  list_init (&t->aio_requests);
   t->next_fd = 2;
   t->next_mmap_fd = 2;
+  t->next_aio_id = 0;
+  t->exec_file = NULL;
   #endif
   t->magic = THREAD_MAGIC;
 
@@ -574,6 +1048,41 @@ init_thread (struct thread *t, const char *name, int priority)
   intr_set_level (old_level);
 }
 
+/* Returns a page for a new thread, recycled if possible, or a
+   null pointer if memory is short. */
+static struct thread *
+alloc_thread_page (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level = intr_disable ();
+
+  if (thread_cache_cnt > 0)
+    {
+      t = thread_cache[--thread_cache_cnt];
+      thread_cache_hits++;
+    }
+  else
+    thread_cache_misses++;
+  intr_set_level (old_level);
+
+  if (t == NULL)
+    t = palloc_get_page (0);
+  return t;
+}
+
+/* Frees the page of dead thread T, keeping it for a new thread if
+   there is room.  Interrupts must be off. */
+static void
+free_thread_page (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_cache_cnt < THREAD_CACHE_SIZE && !thread_cache_off)
+    thread_cache[thread_cache_cnt++] = t;
+  else
+    palloc_free_page (t);
+}
+
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
    returns a pointer to the frame's base. */
 static void *
@@ -587,6 +1096,30 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
+/* Adds T to the back of the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Returns the highest priority of any ready thread.  There must
+   be at least one.  Interrupts must be off. */
+static int
+highest_ready (void)
+{
+  uint32_t high = ready_mask >> 32;
+
+  ASSERT (ready_mask != 0);
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else
+    return 31 - __builtin_clz ((uint32_t) ready_mask);
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
@@ -595,10 +1128,20 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  struct list *queue;
+  struct thread *t;
+  int priority;
+
+  if (ready_mask == 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  priority = highest_ready ();
+  queue = &ready_queues[priority];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  ready_cnt--;
+  if (list_empty (queue))
+    ready_mask &= ~((uint64_t) 1 << priority);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -643,7 +1186,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      free_thread_page (prev);
     }
 }
 
@@ -672,11 +1215,18 @@ static void
 schedule (void)
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
+  struct thread *next;
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
+
+  /* Bring the tick count up to date before anything else runs,
+     if the timer interrupt was stopped while idle. */
+  if (cur == idle_thread)
+    timer_idle_exit ();
+
+  next = next_thread_to_run ();
   ASSERT (is_thread (next));
 
   if (cur != next)
@@ -5,6 +5,7 @@
 #include <list.h>
 #include <hash.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 #include "filesys/file.h"
 
@@ -27,6 +28,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Nice values, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Nicest to others. */
+#define NICE_DEFAULT 0                  /* Default nice value. */
+#define NICE_MAX 20                     /* Least nice to others. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -77,12 +83,13 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* The `elem' member has a triple purpose.  It can be an element
+   in the run queue (thread.c), an element in the sleep queue
+   (thread.c), or an element in a semaphore wait list (synch.c).
+   It can be used these ways only because they are mutually
+   exclusive: only a thread in the ready state is on the run
+   queue, whereas only a thread in the blocked state is on the
+   sleep queue or a semaphore wait list, and never on both. */
 
 struct file_handle
   {
@@ -107,11 +114,18 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* char * file_name */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
+    int base_priority;                  /* Priority without donations. */
+    int64_t wake_tick;                  /* Tick to wake at, if sleeping. */
+    int nice;                           /* Nice value, for MLFQS. */
+    fixed_point recent_cpu;             /* Recent CPU time, for MLFQS. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct list locks;                  /* Locks held. */
+    struct lock *waiting_lock;          /* Lock being waited for, if any. */
+    struct semaphore *waiting_sema;     /* Semaphore waited for, if any. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
@@ -133,6 +147,18 @@ struct thread
     struct list mmap_files;             /*  files mmaped by the process*/
     int next_fd;                        /*  descripton for next open file*/
     int next_mmap_fd;
+
+    /* Owned by userprog/aio.c. */
+    struct list aio_requests;           /* Outstanding asynchronous I/O. */
+    int next_aio_id;                    /* Identifier for next request. */
+    struct file *exec_file;             /* Running executable, write denied. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of transactions. */
+    size_t journal_left;                /* Blocks it may still log. */
+    bool journal_refused;               /* A write did not fit? */
 #endif
 
     /* Owned by thread.c. */
@@ -148,13 +174,16 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_tick (void);
 void thread_print_stats (void);
+void thread_bench (char **argv);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_preempt (void);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -162,15 +191,21 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
-void thread_sleep (void);
+void thread_sleep (int64_t wake_tick);
+void thread_wake (int64_t now);
+int64_t thread_next_wake (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
-void thread_set_waiting_thread_priority (struct thread *, int);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *);
+void thread_update_priority (void);
+int thread_priority_without (const struct lock *);
+bool thread_priority_greater (const struct list_elem *,
+                              const struct list_elem *, void *aux);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
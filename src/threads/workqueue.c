@@ -0,0 +1,317 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A workqueue has a queue of work items and a fixed pool of
+   worker threads, all at the priority it was created with, that
+   take items from the front of the queue and run them.  A work
+   item with a delay waits for a timeout (see devices/timer.h)
+   and is queued when it expires.
+
+   Functions here may sleep, so they must not be called from
+   interrupt handlers or deferred interrupt work.  Such code
+   should queue deferred work (see threads/interrupt.h) that does
+   not sleep instead. */
+
+/* A worker thread. */
+struct worker
+  {
+    struct workqueue *wq;       /* Workqueue it belongs to. */
+    struct work *current;       /* Work it is running, if any. */
+    long long run;              /* Which run of CURRENT it is. */
+  };
+
+struct workqueue
+  {
+    struct list_elem elem;      /* In all_workqueues. */
+    char name[16];              /* Name, for worker threads and stats. */
+    struct lock lock;           /* Protects everything below. */
+    struct list queue;          /* Queued work. */
+    struct condition nonempty;  /* Signaled when work is queued. */
+    struct condition finished;  /* Broadcast when work finishes. */
+    int worker_cnt;             /* Number of workers. */
+    struct worker *workers;     /* The workers. */
+
+    /* Statistics. */
+    size_t depth;               /* Work items queued now. */
+    size_t depth_max;           /* Most ever queued at once. */
+    long long run_cnt;          /* Work items run. */
+    int64_t wait_total;         /* Ticks they waited, in total. */
+    int64_t wait_max;           /* Most ticks one waited. */
+  };
+
+/* All the workqueues, for workqueue_print_stats().  Workqueues are
+   never destroyed. */
+static struct list all_workqueues = LIST_INITIALIZER (all_workqueues);
+
+static thread_func worker_thread NO_RETURN;
+static timeout_func delay_expired;
+static void enqueue (struct workqueue *, struct work *);
+
+/* Initializes work item W to call FUNCTION, passing AUX. */
+void
+work_init (struct work *w, work_func *function, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (function != NULL);
+
+  w->function = function;
+  w->aux = aux;
+  w->wq = NULL;
+  w->queued = w->delayed = false;
+  w->run_cnt = 0;
+  timeout_init (&w->timeout, delay_expired, w);
+}
+
+/* Creates a workqueue named NAME with WORKER_CNT worker threads
+   at the given PRIORITY.  Returns the new workqueue, or a null
+   pointer if memory or threads run out. */
+struct workqueue *
+workqueue_create (const char *name, int worker_cnt, int priority)
+{
+  struct workqueue *wq;
+  int i;
+
+  ASSERT (worker_cnt > 0);
+  ASSERT (priority >= PRI_MIN && priority <= PRI_MAX);
+
+  wq = malloc (sizeof *wq);
+  if (wq == NULL)
+    return NULL;
+  wq->workers = calloc (worker_cnt, sizeof *wq->workers);
+  if (wq->workers == NULL)
+    {
+      free (wq);
+      return NULL;
+    }
+
+  strlcpy (wq->name, name, sizeof wq->name);
+  lock_init (&wq->lock);
+  list_init (&wq->queue);
+  cond_init (&wq->nonempty);
+  cond_init (&wq->finished);
+  wq->worker_cnt = worker_cnt;
+  wq->depth = wq->depth_max = 0;
+  wq->run_cnt = 0;
+  wq->wait_total = wq->wait_max = 0;
+
+  /* A worker that has started cannot be stopped, so from here on
+     the workqueue stays, even if not all its workers start. */
+  list_push_back (&all_workqueues, &wq->elem);
+  for (i = 0; i < worker_cnt; i++)
+    {
+      wq->workers[i].wq = wq;
+      if (thread_create (wq->name, priority, worker_thread, &wq->workers[i])
+          == TID_ERROR)
+        return i > 0 ? wq : NULL;
+    }
+  return wq;
+}
+
+/* Queues W on WQ, to be run by one of its workers.  Returns true
+   if W was queued, false if it was already queued or waiting to
+   be. */
+bool
+queue_work (struct workqueue *wq, struct work *w)
+{
+  bool queued = false;
+
+  lock_acquire (&wq->lock);
+  if (!w->queued && !w->delayed)
+    {
+      enqueue (wq, w);
+      queued = true;
+    }
+  lock_release (&wq->lock);
+  return queued;
+}
+
+/* Queues W on WQ TICKS timer ticks from now, or at once if TICKS
+   is not positive.  Returns true if W will be queued, false if it
+   was already queued or waiting to be. */
+bool
+queue_delayed_work (struct workqueue *wq, struct work *w, int64_t ticks)
+{
+  bool queued = false;
+
+  if (ticks <= 0)
+    return queue_work (wq, w);
+
+  lock_acquire (&wq->lock);
+  if (!w->queued && !w->delayed)
+    {
+      w->wq = wq;
+      w->delayed = true;
+      timeout_add (&w->timeout, ticks);
+      queued = true;
+    }
+  lock_release (&wq->lock);
+  return queued;
+}
+
+/* Takes W off its workqueue's queue, or stops it from being
+   queued if it is waiting for a delay.  Returns true if it did,
+   false if W was neither queued nor waiting.  Does not wait for W
+   to finish if it is running; use flush_work() for that. */
+bool
+cancel_work (struct work *w)
+{
+  struct workqueue *wq = w->wq;
+  bool cancelled = false;
+
+  if (wq == NULL)
+    return false;
+
+  lock_acquire (&wq->lock);
+  if (w->queued)
+    {
+      list_remove (&w->elem);
+      w->queued = false;
+      wq->depth--;
+      cancelled = true;
+    }
+  else if (w->delayed && timeout_cancel (&w->timeout))
+    {
+      w->delayed = false;
+      cancelled = true;
+    }
+  if (cancelled)
+    cond_broadcast (&wq->finished, &wq->lock);
+  lock_release (&wq->lock);
+  return cancelled;
+}
+
+/* Waits until W has run, if it is queued or waiting for a delay,
+   and until it has finished running, if it is running.  A delay
+   is cut short.  Only the run that was pending when this was
+   called is waited for, so W may have been queued again, even by
+   its own function, by the time this returns. */
+void
+flush_work (struct work *w)
+{
+  struct workqueue *wq = w->wq;
+  long long target;
+  bool busy;
+
+  if (wq == NULL)
+    return;
+
+  lock_acquire (&wq->lock);
+  if (w->delayed && timeout_cancel (&w->timeout))
+    {
+      w->delayed = false;
+      enqueue (wq, w);
+    }
+
+  /* Runs are numbered from 1 as workers take W off the queue.  The
+     one to wait for is the next, if W is pending, or else the one
+     started last, if it is still running. */
+  target = w->run_cnt + (w->queued || w->delayed ? 1 : 0);
+  do
+    {
+      int i;
+
+      /* Stop waiting for a pending run that was cancelled. */
+      busy = w->run_cnt < target && (w->queued || w->delayed);
+      for (i = 0; i < wq->worker_cnt && !busy; i++)
+        busy = wq->workers[i].current == w && wq->workers[i].run <= target;
+      if (busy)
+        cond_wait (&wq->finished, &wq->lock);
+    }
+  while (busy);
+  lock_release (&wq->lock);
+}
+
+/* Prints statistics for each workqueue. */
+void
+workqueue_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_workqueues); e != list_end (&all_workqueues);
+       e = list_next (e))
+    {
+      struct workqueue *wq = list_entry (e, struct workqueue, elem);
+
+      printf ("Workqueue %s: %d workers, %lld run, %zu queued "
+              "(at most %zu)", wq->name, wq->worker_cnt, wq->run_cnt,
+              wq->depth, wq->depth_max);
+      if (wq->run_cnt > 0)
+        printf (", waited %"PRId64" ticks on average, at most %"PRId64,
+                wq->wait_total / wq->run_cnt, wq->wait_max);
+      printf ("\n");
+    }
+}
+
+/* Adds W to the back of WQ's queue and wakes a worker.  WQ's lock
+   must be held. */
+static void
+enqueue (struct workqueue *wq, struct work *w)
+{
+  ASSERT (lock_held_by_current_thread (&wq->lock));
+
+  w->wq = wq;
+  w->queued = true;
+  w->queued_tick = timer_ticks ();
+  list_push_back (&wq->queue, &w->elem);
+  if (++wq->depth > wq->depth_max)
+    wq->depth_max = wq->depth;
+  cond_signal (&wq->nonempty, &wq->lock);
+}
+
+/* Called by the timeout thread when the delay of W_ is over. */
+static void
+delay_expired (void *w_)
+{
+  struct work *w = w_;
+  struct workqueue *wq = w->wq;
+
+  lock_acquire (&wq->lock);
+  if (w->delayed)
+    {
+      w->delayed = false;
+      enqueue (wq, w);
+    }
+  lock_release (&wq->lock);
+}
+
+/* Worker thread.  Runs queued work forever. */
+static void
+worker_thread (void *worker_)
+{
+  struct worker *worker = worker_;
+  struct workqueue *wq = worker->wq;
+
+  lock_acquire (&wq->lock);
+  for (;;)
+    {
+      struct work *w;
+      int64_t wait;
+
+      while (list_empty (&wq->queue))
+        cond_wait (&wq->nonempty, &wq->lock);
+      w = list_entry (list_pop_front (&wq->queue), struct work, elem);
+      w->queued = false;
+      wq->depth--;
+      wait = timer_elapsed (w->queued_tick);
+      wq->run_cnt++;
+      wq->wait_total += wait;
+      if (wait > wq->wait_max)
+        wq->wait_max = wait;
+
+      /* W may be freed or queued again once it runs, so it is
+         not touched afterward. */
+      worker->current = w;
+      worker->run = ++w->run_cnt;
+      lock_release (&wq->lock);
+      w->function (w->aux);
+      lock_acquire (&wq->lock);
+      worker->current = NULL;
+      cond_broadcast (&wq->finished, &wq->lock);
+    }
+}
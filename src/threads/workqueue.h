@@ -0,0 +1,41 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/timer.h"
+
+/* Workqueues: pools of kernel threads that run work items queued
+   by other parts of the kernel. */
+
+/* Runs a work item, passing it the AUX given to work_init(). */
+typedef void work_func (void *aux);
+
+/* A work item.  It may be queued again once it has started
+   running, even by its own function, but it must not be freed
+   while queued. */
+struct work
+  {
+    struct list_elem elem;      /* In its workqueue's queue. */
+    work_func *function;        /* Function to run. */
+    void *aux;                  /* Argument to pass it. */
+    struct workqueue *wq;       /* Workqueue it was last queued on. */
+    bool queued;                /* In the queue? */
+    bool delayed;               /* Waiting for its timeout? */
+    int64_t queued_tick;        /* When it was queued. */
+    long long run_cnt;          /* Times a worker has started it. */
+    struct timeout timeout;     /* For queue_delayed_work(). */
+  };
+
+void work_init (struct work *, work_func *, void *aux);
+
+struct workqueue *workqueue_create (const char *name, int worker_cnt,
+                                    int priority);
+bool queue_work (struct workqueue *, struct work *);
+bool queue_delayed_work (struct workqueue *, struct work *, int64_t ticks);
+bool cancel_work (struct work *);
+void flush_work (struct work *);
+void workqueue_print_stats (void);
+
+#endif /* threads/workqueue.h */
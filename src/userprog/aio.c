@@ -0,0 +1,293 @@
+#include "userprog/aio.h"
+#include <aio.h>
+#include <debug.h>
+#include <list.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+
+/* Asynchronous file I/O.
+
+   aio_submit() queues a read or write and returns at once.  The
+   workers of a workqueue carry out queued requests, moving
+   data straight between the file and the user's buffer.  A
+   worker runs in no process's address space and cannot take
+   page faults on the user's behalf, so the buffer's pages are
+   brought in and pinned when the request is submitted, and the
+   worker reaches them through their kernel addresses.  They stay
+   pinned until the process collects the result with aio_wait(),
+   or exits. */
+
+/* Number of worker threads. */
+#define AIO_WORKERS 4
+
+/* An asynchronous I/O request. */
+struct aio_request
+  {
+    int id;                             /* Identifier given to user. */
+    struct thread *owner;               /* Process that submitted it. */
+    struct file *file;                  /* Private handle on the file. */
+    uint8_t *buffer;                    /* User buffer, pinned. */
+    size_t length;                      /* Bytes to transfer. */
+    off_t offset;                       /* File position to start at. */
+    bool write;                         /* Write, or read? */
+
+    int result;                         /* Bytes transferred. */
+    struct semaphore done;              /* Up'd when finished. */
+
+    struct work work;                   /* Carries out the request. */
+    struct list_elem elem;              /* Element in owner's list. */
+  };
+
+/* Workqueue that carries out requests. */
+static struct workqueue *aio_wq;
+
+static work_func run_request;
+
+/* Starts the worker threads. */
+void
+aio_init (void)
+{
+  aio_wq = workqueue_create ("aio", AIO_WORKERS, PRI_DEFAULT);
+  if (aio_wq == NULL)
+    PANIC ("couldn't start aio workers");
+}
+
+/* Returns the number of user pages that request R's buffer
+   spans. */
+static size_t
+page_cnt (const struct aio_request *r)
+{
+  if (r->length == 0)
+    return 0;
+  return (pg_round_down (r->buffer + r->length - 1)
+          - pg_round_down (r->buffer)) / PGSIZE + 1;
+}
+
+/* Returns the number of buffer pages that T's outstanding
+   requests keep pinned. */
+static size_t
+pinned_cnt (struct thread *t)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  for (e = list_begin (&t->aio_requests); e != list_end (&t->aio_requests);
+       e = list_next (e))
+    cnt += page_cnt (list_entry (e, struct aio_request, elem));
+  return cnt;
+}
+
+/* Brings in and pins UPAGE of request R, which must belong to the
+   running process.  Returns false, without pinning it, if R reads
+   into UPAGE but the page is read-only. */
+static bool
+pin_page (struct aio_request *r, uint8_t *upage)
+{
+  struct thread *t = thread_current ();
+  uint8_t *start = upage < r->buffer ? r->buffer : upage;
+  bool writable;
+
+  /* The caller has checked that the buffer is valid user memory, so
+     this just faults the page in if need be and pins it. */
+  frame_pin (start, 1);
+  sema_down (&t->pagedir_mod);
+  writable = pagedir_is_writable (t->pagedir, upage);
+  sema_up (&t->pagedir_mod);
+  if (!r->write && !writable)
+    {
+      frame_unpin (start, 1);
+      return false;
+    }
+  return true;
+}
+
+/* Unpins the first PINNED pages of request R's buffer, which must
+   belong to the running process, closes R's file, and frees R. */
+static void
+release (struct aio_request *r, size_t pinned)
+{
+  uint8_t *upage = pg_round_down (r->buffer);
+  size_t i;
+
+  for (i = 0; i < pinned; i++)
+    frame_unpin (upage + i * PGSIZE, PGSIZE);
+  file_close (r->file);
+  free (r);
+}
+
+/* Starts reading LENGTH bytes from FILE at OFFSET into BUFFER or,
+   if WRITE is true, writing them from BUFFER to FILE.  BUFFER must
+   have been checked to be valid user memory, and should not be
+   touched until the request has finished.  Returns an identifier
+   for the request, to be passed to aio_wait(), or -1 if LENGTH
+   exceeds AIO_MAX_BYTES, the process has too many requests or
+   pinned pages outstanding, memory is short, or BUFFER is
+   read-only and WRITE is false. */
+int
+aio_submit (struct file *file, void *buffer, size_t length, off_t offset,
+            bool write)
+{
+  struct thread *t = thread_current ();
+  struct aio_request *r;
+  size_t pinned;
+
+  if (length > AIO_MAX_BYTES || list_size (&t->aio_requests) >= AIO_MAX)
+    return -1;
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    return -1;
+  r->file = file_reopen (file);
+  if (r->file == NULL)
+    {
+      free (r);
+      return -1;
+    }
+  r->owner = t;
+  r->buffer = buffer;
+  r->length = length;
+  r->offset = offset;
+  r->write = write;
+  r->result = 0;
+  sema_init (&r->done, 0);
+  work_init (&r->work, run_request, r);
+
+  /* Bound the frames one process can take away from eviction. */
+  if (pinned_cnt (t) + page_cnt (r) > AIO_MAX_PAGES)
+    {
+      release (r, 0);
+      return -1;
+    }
+
+  for (pinned = 0; pinned < page_cnt (r); pinned++)
+    if (!pin_page (r, pg_round_down (r->buffer) + pinned * PGSIZE))
+      {
+        release (r, pinned);
+        return -1;
+      }
+
+  r->id = t->next_aio_id++;
+  list_push_back (&t->aio_requests, &r->elem);
+
+  queue_work (aio_wq, &r->work);
+  return r->id;
+}
+
+/* Returns the running process's request with the given ID, or a
+   null pointer if there is none. */
+static struct aio_request *
+find_request (int id)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->aio_requests); e != list_end (&t->aio_requests);
+       e = list_next (e))
+    {
+      struct aio_request *r = list_entry (e, struct aio_request, elem);
+      if (r->id == id)
+        return r;
+    }
+  return NULL;
+}
+
+/* Collects the result of the running process's request ID, first
+   waiting for it to finish if BLOCK is true.  Returns the number
+   of bytes transferred, or -1 if there is no such request.  If
+   BLOCK is false and the request has not finished, returns
+   AIO_PENDING and leaves the request outstanding. */
+int
+aio_wait (int id, bool block)
+{
+  struct aio_request *r = find_request (id);
+  int result;
+
+  if (r == NULL)
+    return -1;
+  if (block)
+    sema_down (&r->done);
+  else if (!sema_try_down (&r->done))
+    return AIO_PENDING;
+
+  result = r->result;
+  list_remove (&r->elem);
+  release (r, page_cnt (r));
+  return result;
+}
+
+/* Abandons every request of the running process, which is
+   exiting.  Requests no worker has started are dropped; those in
+   progress are waited for, since they use the process's pages. */
+void
+aio_exit (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->aio_requests))
+    {
+      struct aio_request *r = list_entry (list_pop_front (&t->aio_requests),
+                                          struct aio_request, elem);
+
+      if (!cancel_work (&r->work))
+        sema_down (&r->done);
+      release (r, page_cnt (r));
+    }
+}
+
+/* Carries out request R a user page at a time, reaching each page
+   through its kernel address.  Returns the number of bytes
+   transferred. */
+static int
+transfer (struct aio_request *r)
+{
+  struct thread *t = r->owner;
+  size_t done = 0;
+
+  while (done < r->length)
+    {
+      uint8_t *upage = r->buffer + done;
+      size_t chunk = PGSIZE - pg_ofs (upage);
+      uint8_t *kaddr = NULL;
+      off_t n;
+
+      if (chunk > r->length - done)
+        chunk = r->length - done;
+
+      /* Writing through the kernel address does not set the
+         user page's dirty bit, so set it here, lest eviction
+         throw away what is read into it. */
+      sema_down (&t->pagedir_mod);
+      if (pagedir_is_present (t->pagedir, upage))
+        {
+          kaddr = pagedir_get_page (t->pagedir, upage);
+          if (!r->write)
+            pagedir_set_dirty (t->pagedir, upage, true);
+        }
+      sema_up (&t->pagedir_mod);
+      if (kaddr == NULL)
+        break;
+
+      n = (r->write
+           ? file_write_at (r->file, kaddr, chunk, r->offset + done)
+           : file_read_at (r->file, kaddr, chunk, r->offset + done));
+      done += n;
+      if ((size_t) n < chunk)
+        break;
+    }
+  return done;
+}
+
+/* Work function.  Carries out request R_. */
+static void
+run_request (void *r_)
+{
+  struct aio_request *r = r_;
+
+  r->result = transfer (r);
+  sema_up (&r->done);
+}
@@ -0,0 +1,16 @@
+#ifndef USERPROG_AIO_H
+#define USERPROG_AIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+
+void aio_init (void);
+int aio_submit (struct file *, void *buffer, size_t length, off_t offset,
+                bool write);
+int aio_wait (int id, bool block);
+void aio_exit (void);
+
+#endif /* userprog/aio.h */
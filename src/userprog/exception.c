@@ -184,28 +184,24 @@ page_fault (struct intr_frame *f)
   if(ret_page != 0)
   {
     struct suppl_page *page = (struct suppl_page *) ret_page;
+    void * br;
     kpage = frame_get (fault_page, true, page->origin);
     /* Get a page of memory. */
     switch (page->location)
     {
       case EXEC:
       case FILE:
-        filesys_lock_acquire ();
-        file_seek (page->origin->source_file, page->origin->offset);
-        int a;
-
-        void * br = malloc (PGSIZE);
-        if ((a = file_read (page->origin->source_file, br, page->origin->zero_after))
+        br = malloc (PGSIZE);
+        if (file_read_at (page->origin->source_file, br, page->origin->zero_after,
+                          page->origin->offset)
           != (int) page->origin->zero_after)
         {
-          filesys_lock_release();
           lock_frames ();
           frame_free (kpage);
           unlock_frames ();
           free (br);
           syscall_t_exit (t->name, -1);
         }
-        filesys_lock_release();
 
         frame_pin_kernel (kpage, PGSIZE);
 
@@ -11,6 +11,8 @@ bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 bool pagedir_set_page_suppl (uint32_t *pd, void *upage, struct suppl_page *page);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+bool pagedir_is_present (uint32_t *pd, const void *upage);
+bool pagedir_is_writable (uint32_t *pd, const void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
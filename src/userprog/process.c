@@ -69,6 +69,7 @@ process_execute (const char *file_name)
     free (parent->child_loading);
     return TID_ERROR;
   }
+  file_close (file);
 
   /* Create a new thread to execute FILE_NAME. */
   tid = thread_create (exec_file_name, PRI_DEFAULT, start_process, fn_copy);
@@ -116,12 +117,8 @@ start_process (void *file_name_)
   if_.eflags = FLAG_IF | FLAG_MBS;
   success = load (exec_file_name, &if_.eip, &if_.esp);
 
-  if (success)
+  if (!success)
   {
-    struct file * file = filesys_open (exec_file_name);
-    thread_add_file (file);
-    file_deny_write (file);
-  } else {
     /* If load failed, quit. */
     palloc_free_page (file_name);
     cur->ret = -1;
@@ -487,8 +484,18 @@ load (const char *file_name, void (**eip) (void), void **esp)
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  /* We arrive here whether the load is successful or not.
+     On success the executable stays open, with writes denied,
+     for as long as the process runs. */
+  if (success)
+    {
+      /* Kept outside the fd table so that close() cannot free it
+         while lazily loaded pages still read from it. */
+      file_deny_write (file);
+      thread_current ()->exec_file = file;
+    }
+  else
+    file_close (file);
   return success;
 }
 
@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <syscall-nr.h>
 #include <string.h>
+#include <iovec.h>
+#include <aio.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -15,6 +17,7 @@
 #include "vm/page.h"
 #include "vm/frame.h"
 
+#include "userprog/aio.h"
 #include "userprog/pagedir.h"
 #include <kernel/stdio.h>
 
@@ -36,14 +39,26 @@ static void syscall_tell (int *, struct intr_frame *);
 static void syscall_close (int *, struct intr_frame *);
 static void syscall_mmap (int *, struct intr_frame *);
 static void syscall_munmap (int *, struct intr_frame *);
+static void syscall_fallocate (int *, struct intr_frame *);
+static void syscall_pread (int *, struct intr_frame *);
+static void syscall_pwrite (int *, struct intr_frame *);
+static void syscall_readv (int *, struct intr_frame *);
+static void syscall_writev (int *, struct intr_frame *);
+static void syscall_copy_file (int *, struct intr_frame *);
+static void syscall_fsync (int *, struct intr_frame *);
+static void syscall_sync (int *, struct intr_frame *);
+static void syscall_aio_submit (int *, struct intr_frame *);
+static void syscall_aio_wait (int *, struct intr_frame *);
+static void syscall_aio_poll (int *, struct intr_frame *);
 
 static void (*syscall_functions[NOA]) (int* , struct intr_frame *); /* Array of syscall functions */
-static struct lock filesys_lock;  /* File system lock */
 
 static int syscall_noa[NOA];  /* Array with number of arguments for every syscall */
 
 static bool DEBUG = false;
 
+static long long syscall_cnt;   /* Number of system calls made */
+
 /* Reads a word at user virtual address UADDR.
 UADDR must be below PHYS_BASE.
 Returns the word value if successful, -1 if a segfault occurred. */
@@ -78,25 +93,27 @@ validate_user (const uint8_t *uaddr)
   return result;
 }
 
-void
-filesys_lock_release ()
-{
-  lock_release (&filesys_lock);
-};
-
-void
-filesys_lock_acquire ()
+/* Checks that the SIZE bytes at user virtual address UADDR all lie
+below PHYS_BASE and that the first and last of them can be read.
+Terminates the process on failure. */
+static void
+validate_user_buffer (const void *uaddr, size_t size)
 {
-  lock_acquire (&filesys_lock);
-};
+  if (size == 0)
+    return;
+  if ((size_t) (PHYS_BASE - uaddr) < size || uaddr >= PHYS_BASE)
+  {
+    syscall_t_exit (thread_current () -> name, -1);
+  }
+  validate_user (uaddr);
+  validate_user ((const uint8_t *) uaddr + size - 1);
+}
 
 void
 syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 
-  lock_init (&filesys_lock);
-
   syscall_functions[SYS_HALT] = &syscall_halt;
   syscall_functions[SYS_EXIT] = &syscall_exit;
   syscall_functions[SYS_EXEC] = &syscall_exec;
@@ -112,6 +129,17 @@ syscall_init (void)
   syscall_functions[SYS_CLOSE] = &syscall_close;
   syscall_functions[SYS_MMAP] = &syscall_mmap;
   syscall_functions[SYS_MUNMAP] = &syscall_munmap;
+  syscall_functions[SYS_FALLOCATE] = &syscall_fallocate;
+  syscall_functions[SYS_PREAD] = &syscall_pread;
+  syscall_functions[SYS_PWRITE] = &syscall_pwrite;
+  syscall_functions[SYS_READV] = &syscall_readv;
+  syscall_functions[SYS_WRITEV] = &syscall_writev;
+  syscall_functions[SYS_COPY_FILE] = &syscall_copy_file;
+  syscall_functions[SYS_FSYNC] = &syscall_fsync;
+  syscall_functions[SYS_SYNC] = &syscall_sync;
+  syscall_functions[SYS_AIO_SUBMIT] = &syscall_aio_submit;
+  syscall_functions[SYS_AIO_WAIT] = &syscall_aio_wait;
+  syscall_functions[SYS_AIO_POLL] = &syscall_aio_poll;
 
   syscall_noa[SYS_HALT] = 0;
   syscall_noa[SYS_EXIT] = 1;
@@ -128,6 +156,17 @@ syscall_init (void)
   syscall_noa[SYS_CLOSE] = 1;
   syscall_noa[SYS_MMAP] = 2;
   syscall_noa[SYS_MUNMAP] = 1;
+  syscall_noa[SYS_FALLOCATE] = 2;
+  syscall_noa[SYS_PREAD] = 4;
+  syscall_noa[SYS_PWRITE] = 4;
+  syscall_noa[SYS_READV] = 3;
+  syscall_noa[SYS_WRITEV] = 3;
+  syscall_noa[SYS_COPY_FILE] = 3;
+  syscall_noa[SYS_FSYNC] = 1;
+  syscall_noa[SYS_SYNC] = 0;
+  syscall_noa[SYS_AIO_SUBMIT] = 1;
+  syscall_noa[SYS_AIO_WAIT] = 1;
+  syscall_noa[SYS_AIO_POLL] = 1;
 }
 
 static void
@@ -136,15 +175,24 @@ syscall_handler (struct intr_frame *f)
   struct thread *t = thread_current ();
   t->esp = f->esp;
   int syscall_number = get_word_user((int *)(f -> esp));
-  if(syscall_number < SYS_HALT || syscall_number > SYS_MUNMAP){
+  if(syscall_number < SYS_HALT || syscall_number >= NOA
+     || syscall_functions[syscall_number] == NULL){
     syscall_t_exit (t -> name, -1);
   }
 
+  syscall_cnt++;
   int *args = syscall_retrieve_args (f);
   syscall_functions[syscall_number] (args, f);
   free (args);
 }
 
+/* Prints system call statistics */
+void
+syscall_print_stats (void)
+{
+  printf ("Syscall: %lld calls\n", syscall_cnt);
+}
+
 /* Function which wrapps everything that has to be done when calling exit */
 void
 syscall_t_exit (char * p_name, int status)
@@ -158,9 +206,9 @@ syscall_t_exit (char * p_name, int status)
 static int *
 syscall_retrieve_args (struct intr_frame *f)
 {
-  int *args = (int*) malloc(3);
   int syscall_number = get_word_user((int *)(f -> esp));
   int noa = syscall_noa[ syscall_number ];
+  int *args = (int*) malloc ((noa + 1) * sizeof (int));
 
   int i;
   for(i = 0; i <= noa; i++){
@@ -194,12 +242,8 @@ syscall_exec (int *args, struct intr_frame *f)
 {
   validate_user((uint8_t *)args[1]);
 
-  filesys_lock_acquire ();
-
   tid_t id = process_execute ((char *)args[1]);
 
-  filesys_lock_release ();
-
   f->eax = id;
 }
 
@@ -217,9 +261,7 @@ syscall_create (int *args, struct intr_frame *f )
 {
   validate_user ((uint8_t *) args[1]);
 
-  filesys_lock_acquire ();
   f->eax = filesys_create ((char *) args[1], args[2]);
-  filesys_lock_release ();
 }
 
 /* bool remove( const char * ) - Deletes a file */
@@ -228,9 +270,7 @@ syscall_remove (int *args, struct intr_frame *f )
 {
   validate_user ((uint8_t *) args[1]);
 
-  filesys_lock_acquire ();
   f->eax = filesys_remove ((char*)args[1]);
-  filesys_lock_release ();
 }
 
 /* bool open( const char * ) - Opens a file */
@@ -239,9 +279,7 @@ syscall_open (int *args, struct intr_frame *f )
 {
   validate_user ((uint8_t *) args[1]);
 
-  filesys_lock_acquire ();
   struct file * file = filesys_open ((char *)args[1]);
-  filesys_lock_release ();
 
   int fd;
   if(file == NULL) {
@@ -274,13 +312,11 @@ syscall_read (int *args, struct intr_frame *f )
     uint8_t * buffer = (uint8_t *) args[2];
     validate_user (buffer);
 
-    filesys_lock_acquire ();
     frame_pin (buffer, args[3]);
     for( ; i < args[3]; i++){
       buffer[i] = input_getc();
     }
     frame_unpin (buffer, args[3]);
-    filesys_lock_release ();
 
     f -> eax = args[3];
   } else if(args[1] == 1){
@@ -294,9 +330,7 @@ syscall_read (int *args, struct intr_frame *f )
 
     void * br = malloc (args[3]);
 
-    filesys_lock_acquire ();
     off_t written = file_read (fh->file, br, args[3]);
-    filesys_lock_release ();
 
     frame_pin (buffer, args[3]);
     memcpy (buffer, br, args[3]);
@@ -322,7 +356,6 @@ syscall_write (int *args, struct intr_frame *f)
     size_t size = args[3];
 
     int written = 0;
-    filesys_lock_acquire ();
     frame_pin (buffer, args[3]);
 
     if(size < 512) putbuf ((char*)buffer, size);
@@ -337,7 +370,6 @@ syscall_write (int *args, struct intr_frame *f)
     }
 
     frame_unpin (buffer, args[3]);
-    filesys_lock_release ();
 
     f -> eax = written;
   } else {
@@ -353,9 +385,7 @@ syscall_write (int *args, struct intr_frame *f)
     memcpy (br, buffer, args[3]);
     frame_unpin (buffer, args[3]);
 
-    filesys_lock_acquire ();
     off_t written = file_write (fh->file, br, args[3]);
-    filesys_lock_release ();
 
     free (br);
 
@@ -371,9 +401,7 @@ syscall_seek (int *args, struct intr_frame *f UNUSED)
   struct file_handle * fh = thread_get_file (&t->files, args[1]);
   if( fh == NULL) syscall_t_exit (t->name, -1);
 
-  filesys_lock_acquire ();
   file_seek (fh->file, args[2]);
-  filesys_lock_release ();
 }
 
 /* unsigned tell( int ) - Returns the position of the next byte to be read or written */
@@ -383,10 +411,8 @@ syscall_tell (int *args, struct intr_frame *f){
   struct file_handle * fh = thread_get_file (&t->files, args[1]);
   if( fh == NULL) syscall_t_exit (t->name, -1);
 
-  filesys_lock_acquire ();
   off_t position = file_tell (fh->file);
   f->eax = position;
-  filesys_lock_release ();
 }
 
 /* void close( int ) - Closes a file with the given descriptor */
@@ -396,10 +422,8 @@ syscall_close (int *args, struct intr_frame *f UNUSED)
   struct thread * t = thread_current();
   struct file_handle * fh = thread_get_file (&t->files, args[1]);
   if( fh == NULL) syscall_t_exit (t -> name, -1);
-  filesys_lock_acquire ();
   file_close (fh -> file);      //Close file in the system
   thread_remove_file (fh); //Remove file from files table
-  filesys_lock_release ();
 }
 
 /* void mmap( int, void * ) - Mmaps a file with the given descriptor to the address in memory */
@@ -477,14 +501,9 @@ syscall_munmap (int *args, struct intr_frame *f UNUSED)
     sema_up (&t->pagedir_mod);
     if(pg_ofs (kpage) == 0 && dirty) {
       int zero_after = (i == pages - 1) ? fl%PGSIZE : PGSIZE;
-      file_seek (fh->file, i*PGSIZE);
 
       frame_pin (uaddr, PGSIZE);
-
-      filesys_lock_acquire ();
-      file_write (fh->file, uaddr, zero_after);
-      filesys_lock_release ();
-
+      file_write_at (fh->file, uaddr, zero_after, i*PGSIZE);
       frame_unpin (uaddr, PGSIZE);
     }
     sema_down (&t->pagedir_mod);
@@ -496,3 +515,301 @@ syscall_munmap (int *args, struct intr_frame *f UNUSED)
   file_close (fh->file);
   free (fh);
 }
+
+/* bool fallocate( int, unsigned ) - Reserves disk space for the first given number of bytes of a file */
+static void
+syscall_fallocate (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  if( (off_t) args[2] < 0 ){
+    f->eax = false;
+    return;
+  }
+  struct file_handle * fh = thread_get_file (&t->files, args[1]);
+  if( fh == NULL ) syscall_t_exit (t->name, -1);
+
+  f->eax = file_allocate (fh->file, args[2]);
+}
+
+/* int pread( int, void *, unsigned, unsigned ) - Reads given number of bytes from the file at the given position, without moving the file position */
+static void
+syscall_pread (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  uint8_t * buffer = (uint8_t *) args[2];
+  validate_user_buffer (buffer, args[3]);
+
+  if( args[1] == 0 || args[1] == 1 || (off_t) args[4] < 0 ){
+    f->eax = -1;
+    return;
+  }
+  struct file_handle * fh = thread_get_file (&t->files, args[1]);
+  if( fh == NULL ) syscall_t_exit (t->name, -1);
+
+  void * br = malloc (args[3]);
+  if( br == NULL && args[3] > 0 ){
+    f->eax = -1;
+    return;
+  }
+
+  off_t bytes_read = file_read_at (fh->file, br, args[3], args[4]);
+
+  frame_pin (buffer, bytes_read);
+  memcpy (buffer, br, bytes_read);
+  frame_unpin (buffer, bytes_read);
+  free (br);
+
+  f->eax = bytes_read;
+}
+
+/* int pwrite( int, const void *, unsigned, unsigned ) - Writes given number of bytes to the file at the given position, without moving the file position */
+static void
+syscall_pwrite (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  uint8_t * buffer = (uint8_t *) args[2];
+  validate_user_buffer (buffer, args[3]);
+
+  if( args[1] == 0 || args[1] == 1 || (off_t) args[4] < 0 ){
+    f->eax = -1;
+    return;
+  }
+  struct file_handle * fh = thread_get_file (&t->files, args[1]);
+  if( fh == NULL ) syscall_t_exit (t->name, -1);
+
+  void * br = malloc (args[3]);
+  if( br == NULL && args[3] > 0 ){
+    f->eax = -1;
+    return;
+  }
+
+  frame_pin (buffer, args[3]);
+  memcpy (br, buffer, args[3]);
+  frame_unpin (buffer, args[3]);
+
+  off_t written = file_write_at (fh->file, br, args[3], args[4]);
+  free (br);
+
+  f->eax = written;
+}
+
+/* Copies the IOVCNT buffer descriptors at user address UIOV into a new
+kernel array, checking every buffer, and stores their total length in
+*TOTAL.  Terminates the process if any of it is not valid user memory.
+Returns NULL if IOVCNT is out of range or memory allocation fails. */
+static struct iovec *
+syscall_copy_iov (const struct iovec *uiov, int iovcnt, size_t *total)
+{
+  if( iovcnt <= 0 || iovcnt > IOV_MAX ) return NULL;
+  validate_user_buffer (uiov, iovcnt * sizeof *uiov);
+
+  struct iovec * iov = malloc (iovcnt * sizeof *iov);
+  if( iov == NULL ) return NULL;
+
+  frame_pin ((void *) uiov, iovcnt * sizeof *uiov);
+  memcpy (iov, uiov, iovcnt * sizeof *uiov);
+  frame_unpin ((void *) uiov, iovcnt * sizeof *uiov);
+
+  int i;
+  *total = 0;
+  for(i = 0; i < iovcnt; i++){
+    validate_user_buffer (iov[i].iov_base, iov[i].iov_len);
+    *total += iov[i].iov_len;
+    if( *total < iov[i].iov_len ){
+      free (iov);
+      return NULL;
+    }
+  }
+  return iov;
+}
+
+/* int readv( int, const struct iovec *, int ) - Reads from the file into each of the given buffers in turn.
+ * The whole transfer is a single read of the file, so it takes the file's lock only once */
+static void
+syscall_readv (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  struct file_handle * fh = NULL;
+  if( args[1] != 0 ){
+    fh = thread_get_file (&t->files, args[1]);
+    if( fh == NULL ) syscall_t_exit (t->name, -1);
+  }
+
+  size_t total;
+  struct iovec * iov = syscall_copy_iov ((const struct iovec *) args[2], args[3], &total);
+  if( iov == NULL ){
+    f->eax = -1;
+    return;
+  }
+  uint8_t * br = malloc (total);
+  if( br == NULL && total > 0 ){
+    free (iov);
+    f->eax = -1;
+    return;
+  }
+
+  off_t bytes_read;
+  if( fh == NULL ){
+    for(bytes_read = 0; bytes_read < (off_t) total; bytes_read++){
+      br[bytes_read] = input_getc();
+    }
+  } else {
+    bytes_read = file_read (fh->file, br, total);
+  }
+
+  /* Scatter what was read over the buffers */
+  off_t copied = 0;
+  int i;
+  for(i = 0; i < args[3] && copied < bytes_read; i++){
+    size_t n = iov[i].iov_len;
+    if( n > (size_t) (bytes_read - copied) ) n = bytes_read - copied;
+    frame_pin (iov[i].iov_base, n);
+    memcpy (iov[i].iov_base, br + copied, n);
+    frame_unpin (iov[i].iov_base, n);
+    copied += n;
+  }
+  free (br);
+  free (iov);
+
+  f->eax = bytes_read;
+}
+
+/* int writev( int, const struct iovec *, int ) - Writes each of the given buffers to the file in turn.
+ * The whole transfer is a single write of the file, so it takes the file's lock only once */
+static void
+syscall_writev (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  struct file_handle * fh = NULL;
+  if( args[1] != 1 ){
+    fh = thread_get_file (&t->files, args[1]);
+    if( fh == NULL ) syscall_t_exit (t->name, -1);
+  }
+
+  size_t total;
+  struct iovec * iov = syscall_copy_iov ((const struct iovec *) args[2], args[3], &total);
+  if( iov == NULL ){
+    f->eax = -1;
+    return;
+  }
+  uint8_t * br = malloc (total);
+  if( br == NULL && total > 0 ){
+    free (iov);
+    f->eax = -1;
+    return;
+  }
+
+  /* Gather the buffers */
+  size_t copied = 0;
+  int i;
+  for(i = 0; i < args[3]; i++){
+    frame_pin (iov[i].iov_base, iov[i].iov_len);
+    memcpy (br + copied, iov[i].iov_base, iov[i].iov_len);
+    frame_unpin (iov[i].iov_base, iov[i].iov_len);
+    copied += iov[i].iov_len;
+  }
+  free (iov);
+
+  off_t written;
+  if( fh == NULL ){
+    for(written = 0; written < (off_t) total; written += 512){
+      putbuf ((char *) br + written, total - written < 512 ? total - written : 512);
+    }
+    written = total;
+  } else {
+    written = file_write (fh->file, br, total);
+  }
+  free (br);
+
+  f->eax = written;
+}
+
+/* int copy_file( int, int, unsigned ) - Copies given number of bytes from one file to another, starting at each file's position,
+ * without the data passing through user space.  Fails if both descriptors refer to the same file */
+static void
+syscall_copy_file (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  if( args[1] == 0 || args[1] == 1 || args[2] == 0 || args[2] == 1 || (off_t) args[3] < 0 ){
+    f->eax = -1;
+    return;
+  }
+  struct file_handle * src = thread_get_file (&t->files, args[1]);
+  struct file_handle * dst = thread_get_file (&t->files, args[2]);
+  if( src == NULL || dst == NULL ) syscall_t_exit (t->name, -1);
+
+  /* Source and destination would overlap */
+  if( file_get_inode (src->file) == file_get_inode (dst->file) ){
+    f->eax = -1;
+    return;
+  }
+
+  f->eax = file_copy (dst->file, src->file, args[3]);
+}
+
+/* bool fsync( int ) - Writes everything written to the file so far to disk */
+static void
+syscall_fsync (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  if( args[1] == 0 || args[1] == 1 ){
+    f->eax = false;
+    return;
+  }
+  struct file_handle * fh = thread_get_file (&t->files, args[1]);
+  if( fh == NULL ) syscall_t_exit (t->name, -1);
+
+  f->eax = file_sync (fh->file);
+}
+
+/* void sync( void ) - Writes all buffered file system data to disk */
+static void
+syscall_sync (int *args UNUSED, struct intr_frame *f UNUSED)
+{
+  filesys_sync ();
+}
+
+/* int aio_submit( const struct aiocb * ) - Starts reading or writing a file in the background, returns a request id */
+static void
+syscall_aio_submit (int *args, struct intr_frame *f)
+{
+  struct thread * t = thread_current ();
+  const struct aiocb * ucb = (const struct aiocb *) args[1];
+  struct aiocb cb;
+  validate_user_buffer (ucb, sizeof cb);
+
+  frame_pin ((void *) ucb, sizeof cb);
+  memcpy (&cb, ucb, sizeof cb);
+  frame_unpin ((void *) ucb, sizeof cb);
+
+  if( cb.aio_fd == 0 || cb.aio_fd == 1 || (off_t) cb.aio_offset < 0
+      || cb.aio_nbytes > AIO_MAX_BYTES ){
+    f->eax = -1;
+    return;
+  }
+
+  /* The workers cannot fault pages in for us, so check every page of the buffer now */
+  validate_user_buffer (cb.aio_buf, cb.aio_nbytes);
+  uint8_t * page;
+  for (page = pg_round_up (cb.aio_buf); page < (uint8_t *) cb.aio_buf + cb.aio_nbytes; page += PGSIZE)
+    validate_user (page);
+  struct file_handle * fh = thread_get_file (&t->files, cb.aio_fd);
+  if( fh == NULL ) syscall_t_exit (t->name, -1);
+
+  f->eax = aio_submit (fh->file, cb.aio_buf, cb.aio_nbytes, cb.aio_offset,
+                       cb.aio_write);
+}
+
+/* int aio_wait( int ) - Waits for a request to finish, returns the number of bytes it transferred */
+static void
+syscall_aio_wait (int *args, struct intr_frame *f)
+{
+  f->eax = aio_wait (args[1], true);
+}
+
+/* int aio_poll( int ) - Returns the number of bytes a request transferred, or AIO_PENDING if it has not finished */
+static void
+syscall_aio_poll (int *args, struct intr_frame *f)
+{
+  f->eax = aio_wait (args[1], false);
+}
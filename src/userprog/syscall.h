@@ -2,8 +2,7 @@
 #define USERPROG_SYSCALL_H
 
 void syscall_init (void);
-void filesys_lock_release (void);
-void filesys_lock_acquire (void);
 void syscall_t_exit (char *, int);
+void syscall_print_stats (void);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,1042 @@
+/* pintos-mkfs.c
+
+   Builds a formatted Pintos file system partition on the host,
+   with files already in it, or checks one.  Usage:
+
+     pintos-mkfs [-s MB] IMAGE FILE[=NAME]...
+     pintos-mkfs -c IMAGE [FILE[=NAME]...]
+     pintos-mkfs -r IMAGE
+
+   The first form creates IMAGE holding each host FILE, under NAME
+   if given or else under the last component of FILE.  Without -s
+   the image is made just large enough, plus 1 MB of free space.
+   Loading files this way is much faster than `pintos -p', which
+   has the kernel extract each one under emulation.  Use the image
+   with `pintos --filesys=IMAGE', and do not pass -f to the kernel,
+   which would format it again.
+
+   Everything is laid out contiguously: the free map, then the
+   root directory, then each file's inode followed by its data,
+   so that every file is a single extent.  Files small enough are
+   stored inline in their inodes, as the kernel does.
+
+   The second form replays the journal if it holds a committed
+   batch, then checks that every sector is owned at most once,
+   that the free map agrees with what is in use, and that every
+   name in the root directory can be found by lookup.  It lists
+   the files with the extents they are in, sums up how fragmented
+   the files and the free space are, compares any FILE given
+   against its copy in the image, and exits with a failure status
+   if anything is wrong.
+
+   The third form checks IMAGE and repairs it as the kernel's
+   `fsck-repair' action does: directory entries with a bad name or
+   inode are erased, entries that lookup cannot find are made
+   reachable, and the free map is rewritten to match the sectors
+   in use.  Sectors used by two files are only reported.  The
+   repaired image is written back, with the journal emptied, and
+   checked again.
+
+   The structures below must match those in src/filesys, and the
+   host must be little-endian, like the i386. */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK_SECTOR_SIZE 512
+#define DIV_ROUND_UP(X, STEP) (((X) + (STEP) - 1) / (STEP))
+
+/* Sectors per megabyte. */
+#define MB_SECTORS (1024 * 1024 / BLOCK_SECTOR_SIZE)
+
+/* Fails to compile if COND is false. */
+#define STATIC_ASSERT(NAME, COND) typedef char NAME[(COND) ? 1 : -1]
+
+/* From filesys/filesys.h and filesys/filesys.c. */
+#define FREE_MAP_SECTOR 0
+#define ROOT_DIR_SECTOR 1
+#define ROOT_DIR_ENTRIES 2048
+
+/* From filesys/journal.h and filesys/journal.c. */
+#define JOURNAL_SECTOR 2
+#define JOURNAL_SECTORS 64
+#define JOURNAL_MAGIC 0x4a524e4c
+#define JOURNAL_CAPACITY (JOURNAL_SECTORS - 1)
+
+struct journal_header
+  {
+    uint32_t magic;
+    uint32_t cnt;
+    uint32_t checksum;
+    uint32_t sectors[JOURNAL_CAPACITY];
+    uint8_t unused[BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)
+                   - JOURNAL_CAPACITY * sizeof (uint32_t)];
+  };
+STATIC_ASSERT (journal_header_size,
+               sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+
+/* From filesys/inode.c. */
+#define INODE_MAGIC 0x494e4f44
+#define INODE_METADATA 0x1
+#define INODE_INLINE 0x2
+
+struct inode_extent
+  {
+    uint32_t ofs;
+    uint32_t start;
+    uint32_t cnt;
+  };
+
+#define INODE_EXTENT_SECTORS 4
+#define INODE_INLINE_MAX (BLOCK_SECTOR_SIZE - 5 * sizeof (uint32_t) \
+                          - INODE_EXTENT_SECTORS * sizeof (uint32_t))
+#define INODE_EXTENTS (INODE_INLINE_MAX / sizeof (struct inode_extent))
+#define EXTENT_SECTOR_EXTENTS \
+  (BLOCK_SECTOR_SIZE / sizeof (struct inode_extent))
+#define INODE_MAX_EXTENTS \
+  (INODE_EXTENTS + INODE_EXTENT_SECTORS * EXTENT_SECTOR_EXTENTS)
+
+struct inode_disk
+  {
+    int32_t length;
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t sector_cnt;
+    uint32_t extent_cnt;
+    uint32_t extent_sectors[INODE_EXTENT_SECTORS];
+    union
+      {
+        struct inode_extent extents[INODE_EXTENTS];
+        uint8_t inline_data[INODE_INLINE_MAX];
+      }
+    u;
+  };
+STATIC_ASSERT (inode_disk_size,
+               sizeof (struct inode_disk) == BLOCK_SECTOR_SIZE);
+
+struct extent_sector
+  {
+    struct inode_extent extents[EXTENT_SECTOR_EXTENTS];
+    uint8_t unused[BLOCK_SECTOR_SIZE
+                   - EXTENT_SECTOR_EXTENTS * sizeof (struct inode_extent)];
+  };
+STATIC_ASSERT (extent_sector_size,
+               sizeof (struct extent_sector) == BLOCK_SECTOR_SIZE);
+
+/* From filesys/directory.h and filesys/directory.c. */
+#define NAME_MAX 14
+
+struct dir_entry
+  {
+    uint32_t inode_sector;
+    char name[NAME_MAX + 1];
+    uint8_t in_use;
+  };
+STATIC_ASSERT (dir_entry_size, sizeof (struct dir_entry) == 20);
+
+#define DIR_BUCKET_ENTRIES \
+  ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) / sizeof (struct dir_entry))
+
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+    uint32_t overflow;
+    uint8_t unused[BLOCK_SECTOR_SIZE
+                   - DIR_BUCKET_ENTRIES * sizeof (struct dir_entry)
+                   - sizeof (uint32_t)];
+  };
+STATIC_ASSERT (dir_bucket_size,
+               sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+#define ROOT_DIR_BUCKETS DIV_ROUND_UP (ROOT_DIR_ENTRIES, DIR_BUCKET_ENTRIES)
+
+/* The image, in memory. */
+static uint8_t *disk;
+static uint32_t disk_sectors;
+static const char *image_name;
+
+/* Number of problems found by check_image(). */
+static int problem_cnt;
+
+static void fail (const char *msg, ...)
+     __attribute__ ((noreturn))
+     __attribute__ ((format (printf, 1, 2)));
+static void fail_io (const char *msg, ...)
+     __attribute__ ((noreturn))
+     __attribute__ ((format (printf, 1, 2)));
+static void problem (const char *msg, ...)
+     __attribute__ ((format (printf, 1, 2)));
+
+/* Prints MSG, formatting as with printf(), and exits. */
+static void
+fail (const char *msg, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "pintos-mkfs: ");
+  va_start (args, msg);
+  vfprintf (stderr, msg, args);
+  va_end (args);
+  putc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+/* Prints MSG, formatting as with printf(),
+   plus an error message based on errno,
+   and exits. */
+static void
+fail_io (const char *msg, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "pintos-mkfs: ");
+  va_start (args, msg);
+  vfprintf (stderr, msg, args);
+  va_end (args);
+
+  if (errno != 0)
+    fprintf (stderr, ": %s", strerror (errno));
+  putc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+/* Reports MSG, formatting as with printf(), as something wrong
+   with the image being checked. */
+static void
+problem (const char *msg, ...)
+{
+  va_list args;
+
+  printf ("%s: ", image_name);
+  va_start (args, msg);
+  vprintf (msg, args);
+  va_end (args);
+  putchar ('\n');
+  problem_cnt++;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr,
+           "usage: pintos-mkfs [-s MB] IMAGE FILE[=NAME]...\n"
+           "       pintos-mkfs -c IMAGE [FILE[=NAME]...]\n"
+           "       pintos-mkfs -r IMAGE\n"
+           "Creates a Pintos file system IMAGE holding the given host\n"
+           "FILEs, or with -c checks IMAGE and compares the FILEs, or\n"
+           "with -r checks and repairs IMAGE.\n");
+  exit (EXIT_FAILURE);
+}
+
+/* Returns a pointer to SECTOR of the image. */
+static void *
+sector_ptr (uint32_t sector)
+{
+  if (sector >= disk_sectors)
+    fail ("sector %u is past the end of the image", sector);
+  return disk + (size_t) sector * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns extent I of the file with inode D, or a null pointer if
+   D has no such extent or its extent sector is not on the
+   image. */
+static struct inode_extent *
+extent (const struct inode_disk *d, uint32_t i)
+{
+  uint32_t sector;
+
+  if (i >= d->extent_cnt || i >= INODE_MAX_EXTENTS)
+    return NULL;
+  if (i < INODE_EXTENTS)
+    return (struct inode_extent *) &d->u.extents[i];
+  i -= INODE_EXTENTS;
+  sector = d->extent_sectors[i / EXTENT_SECTOR_EXTENTS];
+  if (sector == 0 || sector >= disk_sectors)
+    return NULL;
+  return &((struct extent_sector *) sector_ptr (sector))
+          ->extents[i % EXTENT_SECTOR_EXTENTS];
+}
+
+/* Returns the Fowler-Noll-Vo hash of the SIZE bytes in BUF, as
+   lib/kernel/hash.c computes it. */
+static uint32_t
+hash_bytes (const void *buf_, size_t size)
+{
+  const uint8_t *buf = buf_;
+  uint32_t hash = 2166136261u;
+
+  while (size-- > 0)
+    hash = (hash * 16777619u) ^ *buf++;
+  return hash;
+}
+
+/* Returns the hash of string S, as lib/kernel/hash.c computes it. */
+static uint32_t
+hash_string (const char *s)
+{
+  return hash_bytes (s, strlen (s));
+}
+
+/* Returns the number of bytes in the free map of a partition of
+   SECTORS sectors, which like the kernel's bitmap is a whole
+   number of 32-bit words. */
+static uint32_t
+free_map_bytes (uint32_t sectors)
+{
+  return DIV_ROUND_UP (sectors, 32) * 4;
+}
+
+/* Splits ARG, of the form FILE or FILE=NAME, into the host file
+   name and the name of the file in the image.  Modifies ARG. */
+static void
+parse_file_arg (char *arg, const char **file, const char **name)
+{
+  char *eq = strchr (arg, '=');
+
+  *file = arg;
+  if (eq != NULL)
+    {
+      *eq = '\0';
+      *name = eq + 1;
+    }
+  else
+    {
+      const char *slash = strrchr (arg, '/');
+      *name = slash != NULL ? slash + 1 : arg;
+    }
+  if (**name == '\0' || strlen (*name) > NAME_MAX)
+    fail ("%s: names must be 1 to %d characters long", *name, NAME_MAX);
+}
+
+/* Reads all of host file FILE into a new buffer and stores its
+   size in *SIZE. */
+static uint8_t *
+read_file (const char *file, size_t *size)
+{
+  struct stat st;
+  uint8_t *data;
+  FILE *f;
+
+  f = fopen (file, "rb");
+  if (f == NULL || fstat (fileno (f), &st) < 0)
+    fail_io ("%s: open", file);
+  if (st.st_size > INT32_MAX)
+    fail ("%s: too large for Pintos", file);
+  *size = st.st_size;
+  data = malloc (*size + 1);
+  if (data == NULL)
+    fail ("%s: out of memory", file);
+  if (fread (data, 1, *size, f) != *size)
+    fail_io ("%s: read", file);
+  fclose (f);
+  return data;
+}
+
+/* Returns the number of sectors, counting its inode, that a
+   regular file of SIZE bytes takes. */
+static uint32_t
+file_sectors (uint64_t size)
+{
+  if (size <= INODE_INLINE_MAX)
+    return 1;
+  return 1 + DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes an inode to SECTOR for a file of LENGTH bytes with the
+   given FLAGS whose data is the CNT sectors starting at START,
+   and returns it. */
+static struct inode_disk *
+put_inode (uint32_t sector, uint32_t length, uint32_t flags,
+           uint32_t start, uint32_t cnt)
+{
+  struct inode_disk *d = sector_ptr (sector);
+
+  d->length = length;
+  d->magic = INODE_MAGIC;
+  d->flags = flags;
+  if (cnt > 0)
+    {
+      d->sector_cnt = cnt;
+      d->extent_cnt = 1;
+      d->u.extents[0].ofs = 0;
+      d->u.extents[0].start = start;
+      d->u.extents[0].cnt = cnt;
+    }
+  return d;
+}
+
+/* Adds NAME, whose inode is at INODE_SECTOR, to the root
+   directory in BUCKETS, probing forward from its home bucket and
+   marking full buckets as overflowed as dir_add() does. */
+static void
+add_entry (struct dir_bucket *buckets, const char *name,
+           uint32_t inode_sector)
+{
+  size_t idx = hash_string (name) % ROOT_DIR_BUCKETS;
+  size_t probes, i;
+
+  for (probes = 0; probes < ROOT_DIR_BUCKETS; probes++)
+    {
+      struct dir_bucket *b = &buckets[idx];
+
+      /* Nothing is ever removed, so a name already present must
+         come before the first free slot. */
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        {
+          struct dir_entry *e = &b->entries[i];
+          if (!e->in_use)
+            {
+              e->in_use = 1;
+              e->inode_sector = inode_sector;
+              strncpy (e->name, name, NAME_MAX);
+              return;
+            }
+          if (!strcmp (e->name, name))
+            fail ("%s: name given twice", name);
+        }
+      b->overflow = 1;
+      idx = (idx + 1) % ROOT_DIR_BUCKETS;
+    }
+  fail ("more than %d files", ROOT_DIR_ENTRIES);
+}
+
+/* Writes the image in memory to IMAGE. */
+static void
+save_image (void)
+{
+  FILE *out = fopen (image_name, "wb");
+  if (out == NULL)
+    fail_io ("%s: create", image_name);
+  if (fwrite (disk, BLOCK_SECTOR_SIZE, disk_sectors, out) != disk_sectors
+      || fclose (out) != 0)
+    fail_io ("%s: write", image_name);
+}
+
+/* Creates IMAGE, MB megabytes long or, if MB is 0, just large
+   enough, holding the FILE_CNT files named in FILES. */
+static void
+make_image (unsigned mb, char **files, int file_cnt)
+{
+  struct dir_bucket *buckets;
+  struct journal_header *h;
+  uint32_t bitmap_start, root_start, next, i;
+  uint64_t needed;
+  uint8_t *bitmap;
+  int f;
+
+  /* Size the image: fixed sectors, root directory and files, plus
+     the free map, whose size depends on that of the image. */
+  needed = JOURNAL_SECTOR + JOURNAL_SECTORS + ROOT_DIR_BUCKETS;
+  for (f = 0; f < file_cnt; f++)
+    {
+      char *arg = strdup (files[f]);
+      const char *file, *name;
+      struct stat st;
+
+      parse_file_arg (arg, &file, &name);
+      if (stat (file, &st) < 0)
+        fail_io ("%s: stat", file);
+      needed += file_sectors (st.st_size);
+      free (arg);
+    }
+  if (mb == 0)
+    for (mb = 1; ; mb++)
+      {
+        uint64_t sectors = (uint64_t) mb * MB_SECTORS;
+        if (needed + DIV_ROUND_UP (free_map_bytes (sectors),
+                                   BLOCK_SECTOR_SIZE)
+            + MB_SECTORS <= sectors)
+          break;
+      }
+  if ((uint64_t) mb * MB_SECTORS > UINT32_MAX)
+    fail ("%u MB is too large", mb);
+  disk_sectors = mb * MB_SECTORS;
+  needed += DIV_ROUND_UP (free_map_bytes (disk_sectors), BLOCK_SECTOR_SIZE);
+  if (needed > disk_sectors)
+    fail ("%u MB is too small: %llu sectors are needed",
+          mb, (unsigned long long) needed);
+
+  disk = calloc (disk_sectors, BLOCK_SECTOR_SIZE);
+  buckets = calloc (ROOT_DIR_BUCKETS, sizeof *buckets);
+  bitmap = calloc (free_map_bytes (disk_sectors), 1);
+  if (disk == NULL || buckets == NULL || bitmap == NULL)
+    fail ("out of memory");
+
+  /* Empty journal. */
+  h = sector_ptr (JOURNAL_SECTOR);
+  h->magic = JOURNAL_MAGIC;
+
+  /* Files, after the free map and root directory. */
+  bitmap_start = JOURNAL_SECTOR + JOURNAL_SECTORS;
+  root_start = bitmap_start + DIV_ROUND_UP (free_map_bytes (disk_sectors),
+                                            BLOCK_SECTOR_SIZE);
+  next = root_start + ROOT_DIR_BUCKETS;
+  for (f = 0; f < file_cnt; f++)
+    {
+      const char *file, *name;
+      uint32_t inode_sector = next++;
+      uint8_t *data;
+      size_t size;
+
+      parse_file_arg (files[f], &file, &name);
+      data = read_file (file, &size);
+      if (size <= INODE_INLINE_MAX)
+        {
+          struct inode_disk *d = put_inode (inode_sector, size,
+                                            INODE_INLINE, 0, 0);
+          memcpy (d->u.inline_data, data, size);
+        }
+      else
+        {
+          uint32_t cnt = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+          put_inode (inode_sector, size, 0, next, cnt);
+          memcpy (sector_ptr (next), data, size);
+          next += cnt;
+        }
+      add_entry (buckets, name, inode_sector);
+      free (data);
+    }
+
+  /* Root directory. */
+  put_inode (ROOT_DIR_SECTOR, ROOT_DIR_BUCKETS * BLOCK_SECTOR_SIZE,
+             INODE_METADATA, root_start, ROOT_DIR_BUCKETS);
+  memcpy (sector_ptr (root_start), buckets,
+          ROOT_DIR_BUCKETS * sizeof *buckets);
+
+  /* Free map, in which everything before NEXT is in use. */
+  for (i = 0; i < next; i++)
+    bitmap[i / 8] |= 1 << (i % 8);
+  put_inode (FREE_MAP_SECTOR, free_map_bytes (disk_sectors), INODE_METADATA,
+             bitmap_start, root_start - bitmap_start);
+  memcpy (sector_ptr (bitmap_start), bitmap, free_map_bytes (disk_sectors));
+
+  save_image ();
+  printf ("%s: %d files, %u of %u sectors in use\n",
+          image_name, file_cnt, next, disk_sectors);
+
+  free (bitmap);
+  free (buckets);
+}
+
+/* Reads IMAGE into memory. */
+static void
+load_image (void)
+{
+  struct stat st;
+  FILE *in;
+
+  in = fopen (image_name, "rb");
+  if (in == NULL || fstat (fileno (in), &st) < 0)
+    fail_io ("%s: open", image_name);
+  if (st.st_size % BLOCK_SECTOR_SIZE != 0
+      || st.st_size / BLOCK_SECTOR_SIZE <= JOURNAL_SECTOR + JOURNAL_SECTORS
+      || st.st_size / BLOCK_SECTOR_SIZE > UINT32_MAX)
+    fail ("%s: not a file system image", image_name);
+  disk_sectors = st.st_size / BLOCK_SECTOR_SIZE;
+  disk = malloc (st.st_size);
+  if (disk == NULL)
+    fail ("out of memory");
+  if (fread (disk, BLOCK_SECTOR_SIZE, disk_sectors, in) != disk_sectors)
+    fail_io ("%s: read", image_name);
+  fclose (in);
+}
+
+/* Writes a committed journal batch, if there is one, to its home
+   sectors in memory, as the kernel does at mount. */
+static void
+replay_journal (void)
+{
+  struct journal_header *h = sector_ptr (JOURNAL_SECTOR);
+  uint32_t checksum = 0;
+  uint32_t i;
+
+  if (h->magic != JOURNAL_MAGIC)
+    {
+      problem ("bad journal magic %08x", h->magic);
+      return;
+    }
+  if (h->cnt == 0 || h->cnt > JOURNAL_CAPACITY)
+    return;
+
+  for (i = 0; i < h->cnt; i++)
+    {
+      int32_t sector = h->sectors[i];
+      checksum = checksum * 31 + hash_bytes (&sector, sizeof sector);
+      checksum = checksum * 31
+                 + hash_bytes (sector_ptr (JOURNAL_SECTOR + 1 + i),
+                               BLOCK_SECTOR_SIZE);
+    }
+  if (checksum != h->checksum)
+    {
+      printf ("%s: journal batch of %u blocks never committed\n",
+              image_name, h->cnt);
+      return;
+    }
+  for (i = 0; i < h->cnt; i++)
+    memcpy (sector_ptr (h->sectors[i]), sector_ptr (JOURNAL_SECTOR + 1 + i),
+            BLOCK_SECTOR_SIZE);
+  printf ("%s: replayed %u journal blocks\n", image_name, h->cnt);
+}
+
+/* Records in OWNED that SECTOR belongs to WHAT, reporting it if
+   the sector is out of range or already owned. */
+static void
+claim (uint8_t *owned, uint32_t sector, const char *what)
+{
+  if (sector >= disk_sectors)
+    problem ("%s: sector %u is past the end of the image", what, sector);
+  else if (owned[sector])
+    problem ("%s: sector %u is used twice", what, sector);
+  else
+    owned[sector] = 1;
+}
+
+/* Checks the inode in SECTOR, belonging to WHAT, and claims it, its
+   extent sectors and its data sectors in OWNED.  Returns the inode, or a null
+   pointer if it is not valid. */
+static const struct inode_disk *
+check_inode (uint8_t *owned, uint32_t sector, const char *what)
+{
+  const struct inode_disk *d;
+  uint32_t i, j, sector_cnt;
+
+  claim (owned, sector, what);
+  if (sector >= disk_sectors)
+    return NULL;
+  d = sector_ptr (sector);
+  if (d->magic != INODE_MAGIC)
+    {
+      problem ("%s: bad inode magic %08x in sector %u",
+               what, d->magic, sector);
+      return NULL;
+    }
+  if (d->length < 0)
+    {
+      problem ("%s: negative length %d", what, d->length);
+      return NULL;
+    }
+  if (d->flags & INODE_INLINE)
+    {
+      if (d->length > (int32_t) INODE_INLINE_MAX)
+        {
+          problem ("%s: inline file of %d bytes", what, d->length);
+          return NULL;
+        }
+      return d;
+    }
+  if (d->extent_cnt > INODE_MAX_EXTENTS)
+    {
+      problem ("%s: %u extents", what, d->extent_cnt);
+      return NULL;
+    }
+  for (i = 0; i < INODE_EXTENT_SECTORS; i++)
+    if (d->extent_sectors[i] != 0)
+      claim (owned, d->extent_sectors[i], what);
+    else if (d->extent_cnt > INODE_EXTENTS + i * EXTENT_SECTOR_EXTENTS)
+      {
+        problem ("%s: extent sector %u missing", what, i);
+        return NULL;
+      }
+
+  sector_cnt = 0;
+  for (i = 0; i < d->extent_cnt; i++)
+    {
+      const struct inode_extent *e = extent (d, i);
+      if (e == NULL)
+        return NULL;
+      if (e->cnt == 0
+          || (i > 0 && e->ofs < extent (d, i - 1)->ofs
+                                + extent (d, i - 1)->cnt))
+        problem ("%s: extent %u is empty or out of order", what, i);
+      for (j = 0; j < e->cnt; j++)
+        claim (owned, e->start + j, what);
+      sector_cnt += e->cnt;
+    }
+  if (sector_cnt != d->sector_cnt)
+    problem ("%s: extents hold %u sectors, not %u",
+             what, sector_cnt, d->sector_cnt);
+  return d;
+}
+
+/* Copies the contents of the file with inode D into a new buffer,
+   reading holes as zeros, and returns it. */
+static uint8_t *
+read_inode (const struct inode_disk *d)
+{
+  uint8_t *data = calloc (1, (size_t) d->length + 1);
+  uint32_t i;
+
+  if (data == NULL)
+    fail ("out of memory");
+  if (d->flags & INODE_INLINE)
+    memcpy (data, d->u.inline_data, d->length);
+  else
+    for (i = 0; i < d->extent_cnt; i++)
+      {
+        const struct inode_extent *e = extent (d, i);
+        uint64_t ofs, size;
+
+        if (e == NULL)
+          break;
+        ofs = (uint64_t) e->ofs * BLOCK_SECTOR_SIZE;
+        size = (uint64_t) e->cnt * BLOCK_SECTOR_SIZE;
+        if (ofs >= (uint64_t) d->length
+            || (uint64_t) e->start + e->cnt > disk_sectors)
+          continue;
+        if (size > d->length - ofs)
+          size = d->length - ofs;
+        memcpy (data + ofs, sector_ptr (e->start), size);
+      }
+  return data;
+}
+
+/* Copies DATA back into the data sectors of the file with
+   inode D, which must not be inline. */
+static void
+write_inode (const struct inode_disk *d, const uint8_t *data)
+{
+  uint32_t i;
+
+  for (i = 0; i < d->extent_cnt; i++)
+    {
+      const struct inode_extent *e = extent (d, i);
+      uint64_t ofs, size;
+
+      if (e == NULL)
+        break;
+      ofs = (uint64_t) e->ofs * BLOCK_SECTOR_SIZE;
+      size = (uint64_t) e->cnt * BLOCK_SECTOR_SIZE;
+      if (ofs >= (uint64_t) d->length
+          || (uint64_t) e->start + e->cnt > disk_sectors)
+        continue;
+      if (size > d->length - ofs)
+        size = d->length - ofs;
+      memcpy (sector_ptr (e->start), data + ofs, size);
+    }
+}
+
+/* Looks up NAME among the BUCKET_CNT BUCKETS of the root
+   directory as the kernel's lookup() does.  Returns its entry, or
+   a null pointer if it cannot be found. */
+static const struct dir_entry *
+lookup (const struct dir_bucket *buckets, size_t bucket_cnt,
+        const char *name)
+{
+  size_t idx = hash_string (name) % bucket_cnt;
+  size_t probes, i;
+
+  for (probes = 0; probes < bucket_cnt; probes++)
+    {
+      const struct dir_bucket *b = &buckets[idx];
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (b->entries[i].in_use && !strcmp (name, b->entries[i].name))
+          return &b->entries[i];
+      if (!b->overflow)
+        break;
+      idx = (idx + 1) % bucket_cnt;
+    }
+  return NULL;
+}
+
+/* Sets the overflow flag of each of the BUCKET_CNT BUCKETS from
+   NAME's home bucket up to, but not including, bucket IDX, so
+   that lookup() probes as far as IDX. */
+static void
+mark_overflow (struct dir_bucket *buckets, size_t bucket_cnt,
+               const char *name, size_t idx)
+{
+  size_t i;
+
+  for (i = hash_string (name) % bucket_cnt; i != idx; i = (i + 1) % bucket_cnt)
+    buckets[i].overflow = 1;
+}
+
+/* Prints how the sectors not marked in OWNED are spread out. */
+static void
+print_free_space (const uint8_t *owned)
+{
+  uint32_t free_cnt = 0, run_cnt = 0, largest = 0, run = 0;
+  uint32_t i;
+
+  for (i = 0; i <= disk_sectors; i++)
+    if (i < disk_sectors && !owned[i])
+      run++;
+    else if (run > 0)
+      {
+        free_cnt += run;
+        run_cnt++;
+        if (run > largest)
+          largest = run;
+        run = 0;
+      }
+  printf ("%s: %u free sectors in %u runs, largest %u\n",
+          image_name, free_cnt, run_cnt, largest);
+}
+
+/* Compares each of the FILE_CNT host files in FILES with its copy
+   among the BUCKET_CNT BUCKETS of the root directory. */
+static void
+compare_files (const struct dir_bucket *buckets, size_t bucket_cnt,
+               char **files, int file_cnt)
+{
+  int f;
+
+  for (f = 0; f < file_cnt; f++)
+    {
+      const struct inode_disk *d;
+      const struct dir_entry *e;
+      const char *file, *name;
+      uint8_t *data, *copy;
+      size_t size;
+
+      parse_file_arg (files[f], &file, &name);
+      e = lookup (buckets, bucket_cnt, name);
+      if (e == NULL)
+        {
+          problem ("%s: not found", name);
+          continue;
+        }
+
+      /* check_image() has already reported a bad inode. */
+      if (e->inode_sector >= disk_sectors)
+        continue;
+      d = sector_ptr (e->inode_sector);
+      if (d->magic != INODE_MAGIC || d->length < 0)
+        continue;
+
+      data = read_file (file, &size);
+      if ((size_t) d->length != size)
+        problem ("%s: %d bytes, but %s has %zu", name, d->length, file, size);
+      else
+        {
+          copy = read_inode (d);
+          if (memcmp (copy, data, size))
+            problem ("%s: differs from %s", name, file);
+          free (copy);
+        }
+      free (data);
+    }
+}
+
+/* Checks IMAGE, comparing the FILE_CNT files named in FILES with
+   their copies in it.  If REPAIR is true, also repairs what it
+   can and, if that changes anything, writes IMAGE back and sets
+   *REPAIRED to true.  Returns true if no problems were found. */
+static bool
+check_image (char **files, int file_cnt, bool repair, bool *repaired)
+{
+  const struct inode_disk *free_map, *root;
+  struct dir_bucket *buckets = NULL;
+  uint8_t *bitmap = NULL, *owned;
+  uint32_t i, j, in_use, leaked;
+  uint32_t sector_total = 0, extent_total = 0, fragmented_cnt = 0;
+  size_t bucket_cnt = 0;
+  bool changed = false;
+  int name_cnt = 0;
+
+  problem_cnt = 0;
+  load_image ();
+  replay_journal ();
+
+  owned = calloc (disk_sectors, 1);
+  if (owned == NULL)
+    fail ("out of memory");
+  for (i = 0; i < JOURNAL_SECTORS; i++)
+    claim (owned, JOURNAL_SECTOR + i, "journal");
+
+  free_map = check_inode (owned, FREE_MAP_SECTOR, "free map");
+  if (free_map != NULL)
+    {
+      if ((uint32_t) free_map->length < free_map_bytes (disk_sectors))
+        problem ("free map: %d bytes, too short for %u sectors",
+                 free_map->length, disk_sectors);
+      else
+        bitmap = read_inode (free_map);
+    }
+
+  root = check_inode (owned, ROOT_DIR_SECTOR, "root directory");
+  if (root != NULL)
+    {
+      if (root->length == 0 || root->length % BLOCK_SECTOR_SIZE != 0)
+        problem ("root directory: length %d is not a whole number "
+                 "of buckets", root->length);
+      else
+        {
+          buckets = (struct dir_bucket *) read_inode (root);
+          bucket_cnt = root->length / BLOCK_SECTOR_SIZE;
+        }
+    }
+
+  /* Files. */
+  for (i = 0; i < bucket_cnt; i++)
+    for (j = 0; j < DIR_BUCKET_ENTRIES; j++)
+      {
+        struct dir_entry *e = &buckets[i].entries[j];
+        const struct inode_disk *d = NULL;
+        bool bad = false;
+
+        if (!e->in_use)
+          continue;
+        e->name[NAME_MAX] = '\0';
+        if (e->name[0] == '\0')
+          {
+            problem ("entry for inode %u has an empty name",
+                     e->inode_sector);
+            bad = true;
+          }
+        else if (e->inode_sector < disk_sectors && owned[e->inode_sector])
+          {
+            problem ("%s: inode sector %u is already in use",
+                     e->name, e->inode_sector);
+            bad = true;
+          }
+        else
+          {
+            d = check_inode (owned, e->inode_sector, e->name);
+            bad = d == NULL;
+          }
+        if (bad)
+          {
+            if (repair)
+              {
+                e->in_use = 0;
+                changed = true;
+              }
+            continue;
+          }
+
+        name_cnt++;
+        if (lookup (buckets, bucket_cnt, e->name) != e)
+          {
+            problem ("%s: cannot be found by lookup", e->name);
+            if (repair)
+              {
+                mark_overflow (buckets, bucket_cnt, e->name, i);
+                changed = true;
+              }
+          }
+        printf ("%-14s %10d bytes %6u sectors %3u extents%s\n",
+                e->name, d->length, d->sector_cnt, d->extent_cnt,
+                d->flags & INODE_INLINE ? " (inline)" : "");
+        if (!(d->flags & INODE_INLINE))
+          {
+            sector_total += d->sector_cnt;
+            extent_total += d->extent_cnt;
+            if (d->extent_cnt > 1)
+              fragmented_cnt++;
+          }
+      }
+
+  /* Free map against what is in use. */
+  in_use = leaked = 0;
+  if (bitmap != NULL)
+    for (i = 0; i < disk_sectors; i++)
+      {
+        bool marked = (bitmap[i / 8] >> (i % 8)) & 1;
+        if (owned[i])
+          {
+            in_use++;
+            if (!marked)
+              problem ("sector %u is in use but free in the free map", i);
+          }
+        else if (marked)
+          leaked++;
+        if (repair && owned[i] != marked)
+          {
+            bitmap[i / 8] ^= 1 << (i % 8);
+            changed = true;
+          }
+      }
+  if (leaked > 0)
+    problem ("%u sectors are marked in use but belong to nothing", leaked);
+
+  if (buckets != NULL)
+    compare_files (buckets, bucket_cnt, files, file_cnt);
+
+  printf ("%s: %u sectors of files in %u extents, %u files fragmented\n",
+          image_name, sector_total, extent_total, fragmented_cnt);
+  print_free_space (owned);
+  printf ("%s: %d files, %u of %u sectors in use, %d problems\n",
+          image_name, name_cnt, in_use, disk_sectors, problem_cnt);
+
+  if (changed)
+    {
+      struct journal_header *h = sector_ptr (JOURNAL_SECTOR);
+
+      /* The journal has been replayed, and replaying it again
+         at mount would undo the repairs. */
+      h->cnt = 0;
+      if (buckets != NULL)
+        write_inode (root, (uint8_t *) buckets);
+      if (bitmap != NULL)
+        write_inode (free_map, bitmap);
+      save_image ();
+      *repaired = true;
+    }
+
+  free (owned);
+  free (bitmap);
+  free (buckets);
+  free (disk);
+  return problem_cnt == 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  bool check = false, repair = false, repaired = false;
+  unsigned mb = 0;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "crs:")) != -1)
+    switch (opt)
+      {
+      case 'c':
+        check = true;
+        break;
+      case 'r':
+        repair = true;
+        break;
+      case 's':
+        mb = atoi (optarg);
+        if (mb == 0)
+          usage ();
+        break;
+      default:
+        usage ();
+      }
+  if (optind >= argc || (check && repair) || ((check || repair) && mb != 0)
+      || (repair && optind + 1 != argc))
+    usage ();
+  image_name = argv[optind++];
+
+  if (check)
+    return check_image (argv + optind, argc - optind, false, &repaired)
+           ? EXIT_SUCCESS : EXIT_FAILURE;
+  if (repair)
+    {
+      /* The sectors of an erased entry are only seen to be free
+         by the next pass. */
+      int pass;
+      bool ok;
+
+      for (pass = 1; ; pass++)
+        {
+          repaired = false;
+          ok = check_image (NULL, 0, true, &repaired);
+          if (!repaired || pass == 3)
+            break;
+          printf ("%s: repaired, checking again\n", image_name);
+        }
+      return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  make_image (mb, argv + optind, argc - optind);
+  return EXIT_SUCCESS;
+}
@@ -58,7 +58,7 @@ frame_get (void * upage, bool zero, struct origin_info *origin){
 		frame -> upage = upage;
 		frame -> origin = origin;
 		frame -> thread = t;
-		frame -> pinned = false;
+		frame -> pinned = 0;
 
 		lock_frames ();
 		hash_insert (&frames, &frame -> hash_elem);
@@ -94,7 +94,8 @@ frame_free (void * addr){
 }
 
 /*
-Sets frame's pin to the given value
+Adds a pin to the frame if pinval is true, otherwise removes one.
+Pins nest, so the frame stays unevictable until all are removed.
 */
 void
 frame_set_pin (void * kpage, bool pinval){
@@ -102,43 +103,64 @@ frame_set_pin (void * kpage, bool pinval){
     if(frame == NULL)  {
     	return;
     }
-    frame->pinned = pinval;
+    if(pinval) frame->pinned++;
+    else {
+    	ASSERT (frame->pinned > 0);
+    	frame->pinned--;
+    }
 }
 
 /*
-Pins a frame using user virtual memory address
+Pins every page holding the L bytes at user virtual address vaddr,
+faulting in those that are not present, so that frame_unpin() with
+the same arguments finds exactly the same pages.  An invalid address
+terminates the process in the page fault handler.
 */
 void
 frame_pin (void * vaddr, int l){
 	struct thread * t = thread_current ();
-	int i;
-	int it = l / PGSIZE;
-	if(l % PGSIZE) it++;
-	for(i = 0; i < it; i++){
-		sema_down (&t->pagedir_mod);
-		void * kpage = pagedir_get_page (t->pagedir, pg_round_down(vaddr) + i * PGSIZE);
-		sema_up (&t->pagedir_mod);
-		if(kpage == 0 || pg_ofs (kpage) != 0) return;
-		frame_set_pin (kpage, true);
+	uint8_t * upage;
+
+	if(l <= 0) return;
+	for(upage = pg_round_down (vaddr); upage < (uint8_t *) vaddr + l; upage += PGSIZE){
+		for(;;){
+			/* Eviction happens with the frame table locked, so the page
+			   cannot go away between finding it and pinning it. */
+			lock_frames ();
+			sema_down (&t->pagedir_mod);
+			void * kpage = pagedir_get_page (t->pagedir, upage);
+			sema_up (&t->pagedir_mod);
+			if(kpage != 0 && pg_ofs (kpage) == 0){
+				frame_set_pin (kpage, true);
+				unlock_frames ();
+				break;
+			}
+			unlock_frames ();
+
+			/* Fault the page in, touching only bytes inside the range. */
+			(void) *(volatile uint8_t *) (upage < (uint8_t *) vaddr ? vaddr : upage);
+		}
 	}
 }
 
 /*
-Unpins a frame using user virtual memory address
+Unpins the pages pinned by frame_pin() with the same arguments.
 */
 void 
 frame_unpin (void * vaddr, int l){
 	struct thread * t = thread_current ();
-	int i;
-	int it = l / PGSIZE;
-	if(l % PGSIZE) it++;
-	for(i = 0; i < it; i++){
+	uint8_t * upage;
+
+	if(l <= 0) return;
+	lock_frames ();
+	for(upage = pg_round_down (vaddr); upage < (uint8_t *) vaddr + l; upage += PGSIZE){
 		sema_down (&t->pagedir_mod);
-		void * kpage = pagedir_get_page (t->pagedir, pg_round_down (vaddr) + i * PGSIZE);
+		void * kpage = pagedir_get_page (t->pagedir, upage);
 		sema_up (&t->pagedir_mod);
-		if(kpage == 0 || pg_ofs (kpage) != 0)  return;
-	    frame_set_pin (kpage, false);
+		ASSERT (kpage != 0 && pg_ofs (kpage) == 0);
+		frame_set_pin (kpage, false);
 	}
+	unlock_frames ();
 }
 
 /*
@@ -235,19 +257,17 @@ page_dump( struct frame * frame ){
 	{
 		if (frame->origin != NULL && frame->origin->location == FILE)
 		{
-			filesys_lock_acquire ();
-			frame_pin (frame->upage, PGSIZE);
+			frame_pin_kernel (frame->addr, PGSIZE);
 			file_write_at (frame->origin->source_file, frame->addr, frame->origin->zero_after, frame->origin->offset);
-			frame_unpin (frame->upage, PGSIZE);
-			filesys_lock_release ();
+			frame_unpin_kernel (frame->addr, PGSIZE);
 
 			suppl_page = new_file_page (frame->origin->source_file, frame->origin->offset, frame->origin->zero_after, frame->origin->writable, FILE);
 		} else {
 			struct swap_slt * swap_el = swap_slot(frame);
 
-			frame_pin (frame->upage, PGSIZE);
+			frame_pin_kernel (frame->addr, PGSIZE);
 			swap_store (swap_el);
-			frame_unpin (frame->upage, PGSIZE);
+			frame_unpin_kernel (frame->addr, PGSIZE);
 
 			suppl_page = new_swap_page (swap_el);
 		}
@@ -10,7 +10,7 @@ struct frame {
 	void *upage;				/* User virtual address of the page*/
 	struct thread *thread;		/* Thread the page belongs to*/
 	struct origin_info *origin; /* Source of origin*/
-	bool pinned;				/* Pin - makes the page not evictable */
+	int pinned;					/* Pin count - page is not evictable while nonzero */
 
 	struct hash_elem hash_elem;
 };